@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_pause.h>
+
+#include "util.h"
+#include "conf.h"
+#include "core.h"
+#include "port.h"
+#include "burst.h"
+
+/**
+ * Peak and histogram of one rate, updated online for every sample
+ */
+struct burst_rate_t {
+    double peak;                // Gbps
+    double sum;                 // Sum of per-sample Gbps, for the average
+    uint64_t hist[BURST_BUCKETS];
+};
+
+struct burst_t {
+    pthread_t sampler;
+    volatile bool stop;
+    bool running;
+    uint64_t period;            // Cycles between samples
+    double link_gbps;
+    uint64_t num_sample;        // Total samples taken
+    uint64_t late;              // Samples taken more than one period late
+    struct burst_sample_t* ring;
+    struct burst_rate_t rx;
+    struct burst_rate_t tx;
+    uint64_t missed_samples;    // Samples in which the NIC dropped packets
+    uint64_t peak_pkts[MAX_LCORE];
+    uint64_t sum_pkts[MAX_LCORE];
+};
+
+struct burst_t burst = {0};
+
+static inline void
+burst_rate_add(struct burst_rate_t* rate, double gbps, double link_gbps) {
+    int bucket = (int) (gbps * 10 / link_gbps);
+    rate->hist[RTE_MIN(bucket, BURST_BUCKETS-1)]++;
+    rate->peak = RTE_MAX(rate->peak, gbps);
+    rate->sum += gbps;
+}
+
+/**
+ * Sum the counters of all ports
+ */
+static inline void
+burst_read(struct burst_sample_t* sample) {
+    struct conf_t* conf = get_conf();
+    struct rte_eth_stats st;
+    memset(sample, 0, sizeof(struct burst_sample_t));
+    for (uint16_t loop = 0; loop < conf->num_port; loop++) {
+        rte_eth_stats_get(conf->ports[loop], &st);
+        sample->ipackets += st.ipackets;
+        sample->ibytes   += st.ibytes;
+        sample->opackets += st.opackets;
+        sample->obytes   += st.obytes;
+        sample->imissed  += st.imissed;
+    }
+    sample->tsc = rte_rdtsc();
+}
+
+static void*
+burst_sampler(__rte_unused void* arg) {
+    struct conf_t* conf = get_conf();
+    const struct app_stat_t* app = get_app_stat();
+    struct burst_sample_t cur, pre;
+    uint64_t pkts_pre[MAX_LCORE];
+
+    burst_read(&pre);
+    for (int loop = 1; loop < conf->total_lcore; loop++)
+        pkts_pre[loop] = app[loop].sent_pkts + app[loop].acked_pkts;
+
+    uint64_t next = pre.tsc + burst.period;
+    while (burst.stop == false) {
+        // Spin, sleeping cannot keep a 10us period
+        while (rte_rdtsc() < next)
+            rte_pause();
+        burst_read(&cur);
+        if (cur.tsc > next + burst.period)
+            burst.late++;
+        next += burst.period;
+        if (next < cur.tsc)
+            next = cur.tsc + burst.period;
+
+        double ns = hz_to_ns(cur.tsc - pre.tsc);
+        if (ns > 0) {
+            burst_rate_add(&burst.rx, ((cur.ipackets - pre.ipackets) * SIZE_LINK_OVERHEAD + cur.ibytes - pre.ibytes) * 8 / ns, burst.link_gbps);
+            burst_rate_add(&burst.tx, ((cur.opackets - pre.opackets) * SIZE_LINK_OVERHEAD + cur.obytes - pre.obytes) * 8 / ns, burst.link_gbps);
+        }
+        if (cur.imissed != pre.imissed)
+            burst.missed_samples++;
+        for (int loop = 1; loop < conf->total_lcore; loop++) {
+            uint64_t pkts = app[loop].sent_pkts + app[loop].acked_pkts;
+            burst.peak_pkts[loop] = RTE_MAX(burst.peak_pkts[loop], pkts - pkts_pre[loop]);
+            burst.sum_pkts[loop] += pkts - pkts_pre[loop];
+            pkts_pre[loop] = pkts;
+        }
+
+        burst.ring[burst.num_sample % BURST_RING_SIZE] = cur;
+        burst.num_sample++;
+        pre = cur;
+    }
+    return NULL;
+}
+
+void
+burst_start(void) {
+    struct conf_t* conf = get_conf();
+    if (conf->burst_us == 0)
+        return;
+
+    uint32_t link_speed = port_link_speed();
+    burst.link_gbps = (link_speed > 0) ? link_speed / 1000.0 : 100.0;
+    burst.period    = time_to_hz_us(conf->burst_us);
+    burst.ring      = (struct burst_sample_t*) calloc(BURST_RING_SIZE, sizeof(struct burst_sample_t));
+    if (burst.ring == NULL) {
+        LOG_WARN("Cannot allocate the microburst ring, ignore --microburst\n");
+        return;
+    }
+
+    burst.stop = false;
+    if (rte_ctrl_thread_create(&burst.sampler, "dperf-burst", NULL, burst_sampler, NULL) != 0) {
+        LOG_WARN("Cannot create the microburst sampler, ignore --microburst\n");
+        free(burst.ring);
+        burst.ring = NULL;
+        return;
+    }
+    burst.running = true;
+    LOG_INFO("Sampling counters every %u us (%lu cycles)\n", conf->burst_us, burst.period);
+}
+
+static void
+print_burst_rate(const char* dir, struct burst_rate_t* rate) {
+    double avg = rate->sum / burst.num_sample;
+    LOG_INFO("%s  peak %7.2f Gbps  average %7.2f Gbps  peak/average %6.2f\n", dir, rate->peak, avg, avg > 0 ? rate->peak / avg : 0);
+    char line[256] = {0};
+    int len = 0;
+    for (int loop = 0; loop < BURST_BUCKETS; loop++)
+        len += sprintf(line + len, " %5.1f%%", rate->hist[loop] * 100.0 / burst.num_sample);
+    LOG_INFO("%s  histogram (share of samples at 0-10%% .. >=100%% of %.0f Gbps):%s\n", dir, burst.link_gbps, line);
+}
+
+void
+burst_stop(void) {
+    struct conf_t* conf = get_conf();
+    if (burst.running == false)
+        return;
+    burst.stop = true;
+    pthread_join(burst.sampler, NULL);
+    burst.running = false;
+    if (burst.num_sample == 0)
+        return;
+
+    LOG_LINE(75, '-', "Microburst Statistics");
+    LOG_INFO("%lu samples every %u us, %lu late, %lu with NIC drops (imissed)\n",
+        burst.num_sample, conf->burst_us, burst.late, burst.missed_samples);
+    print_burst_rate("RX", &burst.rx);
+    print_burst_rate("TX", &burst.tx);
+    LOG_INFO("Thread  Peak Pkts/Sample  Avg Pkts/Sample\n");
+    for (int loop = 1; loop < conf->total_lcore; loop++) {
+        LOG_INFO("  %02d    %16lu  %15.2f\n", loop, burst.peak_pkts[loop], (double) burst.sum_pkts[loop] / burst.num_sample);
+    }
+    LOG_LINE(75, '-', NULL);
+
+    FILE* fp = fopen(BURST_DUMP_PATH, "w");
+    if (fp != NULL) {
+        uint64_t first = (burst.num_sample > BURST_RING_SIZE) ? burst.num_sample - BURST_RING_SIZE : 0;
+        uint64_t base  = burst.ring[first % BURST_RING_SIZE].tsc;
+        fprintf(fp, "time_ns ipackets ibytes opackets obytes imissed\n");
+        for (uint64_t loop = first; loop < burst.num_sample; loop++) {
+            struct burst_sample_t* s = &burst.ring[loop % BURST_RING_SIZE];
+            fprintf(fp, "%lu %lu %lu %lu %lu %lu\n", hz_to_ns(s->tsc - base), s->ipackets, s->ibytes, s->opackets, s->obytes, s->imissed);
+        }
+        fclose(fp);
+        LOG_INFO("Write the last %lu raw samples to %s\n", burst.num_sample - first, BURST_DUMP_PATH);
+    }
+    free(burst.ring);
+    burst.ring = NULL;
+}
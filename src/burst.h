@@ -0,0 +1,43 @@
+#ifndef _BURST_H_
+#define _BURST_H_
+
+#include <stdint.h>
+
+#include "conf.h"
+
+/**
+ * Number of raw samples kept (the most recent ones), dumped at exit
+ */
+#define BURST_RING_SIZE       65536
+/**
+ * Buckets of the burst histogram, by 10% of the link speed, the last one is
+ * for samples at or above the link speed
+ */
+#define BURST_BUCKETS         11
+#define BURST_DUMP_PATH       "dperf_burst.txt"
+
+/**
+ * A raw sample of the port counters, summed over all ports
+ */
+struct burst_sample_t {
+    uint64_t tsc;
+    uint64_t ipackets;
+    uint64_t ibytes;
+    uint64_t opackets;
+    uint64_t obytes;
+    uint64_t imissed;
+};
+
+/**
+ * Start sampling port and per-thread counters every `burst_us` microseconds
+ * on a control thread, so the overhead stays off the worker lcores
+ */
+void burst_start(void);
+
+/**
+ * Stop sampling, print peak vs average rates and burst histograms, and dump
+ * the most recent raw samples to BURST_DUMP_PATH
+ */
+void burst_stop(void);
+
+#endif
@@ -3,10 +3,16 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <ctype.h>
 #include <getopt.h>
+#include <sys/stat.h>
 
 #include "util.h"
 #include "conf.h"
+#include "fct.h"
+#include "result.h"
+#include "sweep.h"
+#include "port.h"
 
 /**
  * Gloabl configuration
@@ -17,6 +23,10 @@ struct conf_t global_conf = {0};
  * A flag to indicate whether force quit the application
  */
 volatile bool force_quit = false;
+/**
+ * Set by SIGINT/SIGTERM, unlike force_quit it is never cleared
+ */
+volatile bool force_exit = false;
 
 struct conf_t* get_conf(void) {
     return &global_conf;
@@ -32,11 +42,20 @@ set_quit(void) {
     force_quit = true; 
 }
 
+int
+reset_quit(void) {
+    if (force_exit == true)
+        return -1;
+    force_quit = false;
+    return 0;
+}
+
 void
 signal_handler(int signum) {
     if (signum == SIGINT || signum == SIGTERM) {
         printf("\n");
         LOG_WARN("Signal %d received, preparing to exit ...\n", signum);
+        force_exit = true;
         force_quit = true;
     } else {
         printf("\n");
@@ -52,26 +71,142 @@ show_usage(char* app) {
     LOG_INFO("Client/Server:\n");
     LOG_INFO("    -i, --interval  #[s|ms]        seconds between periodic bandwidth reports\n");
     LOG_INFO("    -p, --port      #              server port to listen on/connect to\n");
-    LOG_INFO("    -B, --bind      <host>         bind to <host>, an interface or multicast address\n");
+    LOG_INFO("    -B, --bind      <host>[,...]   bind to <host>, an interface or multicast address, one per port (<= 4)\n");
     LOG_INFO("    -N, --nic       <nic>          bind to <nic>, a network interface\n");
     LOG_INFO("    -P, --parallel  #              number of threads to run\n");
+    LOG_INFO("    -F, --file      <path>         send <path> (client) or write received data to <path> (server),\n");
+    LOG_INFO("                                   TCP only, -P and --bufsize must match on both sides\n");
     LOG_INFO("        --rtt       #              run %s client for latency test in ping pong mode\n", app);
+    LOG_INFO("        --pmu                      count cycles, instructions, LLC and branch misses per thread\n");
+    LOG_INFO("        --steer     <mode>         RX queue steering: auto|flow|rss (Defaults: auto, rss if rte_flow fails)\n");
+    LOG_INFO("        --rss-key   <hex>          %d-byte Toeplitz key of rss steering (Defaults: symmetric 6d5a...)\n", RSS_KEY_LEN);
+    LOG_INFO("        --rxd       #              RX descriptors per queue (Defaults: %d)\n", SIZE_RING_RX);
+    LOG_INFO("        --txd       #              TX descriptors per queue (Defaults: %d)\n", SIZE_RING_TX);
+    LOG_INFO("        --burst     #[,#]          RX[,TX] burst of the threads (Defaults: %d, <= %d)\n", CLIENT_SIZE_BURST_RX, MAX_SIZE_BURST);
+    LOG_INFO("        --pool      #              mbufs in the pool of each thread (Defaults: fit to the rings)\n");
+    LOG_INFO("        --mcache    #              per-lcore cache of the mbuf pools (Defaults: %d)\n", SIZE_MCACHE);
+    LOG_INFO("        --vdev      <dev>[,<args>] run on a virtual device instead of a NIC, net_ring|net_memif|net_null|net_tap,\n");
+    LOG_INFO("                                   one per -B address, no hugepages needed\n");
+    LOG_INFO("        --mbuf-size #              data room of the mbufs, below -l frames are chained (Defaults: fit -l)\n");
+    LOG_INFO("        --vlan      #              tag the frames with 802.1Q VLAN # (1-4094), set on both sides\n");
+    LOG_INFO("        --encap     <tunnel>       encapsulate the frames in vxlan[,<vni>]|gre, set on both sides\n");
+    LOG_INFO("        --microburst #             sample port and thread counters every # us (10-1000) and report bursts\n");
+    LOG_INFO("        --results   <path>         append a record of the run to <path> (Defaults: %s)\n", RESULT_PATH);
+    LOG_INFO("        --tag       <label>        label of the run in the results file (Defaults: default)\n");
+    LOG_INFO("        --compare   <base>,<cand>  compare the runs tagged <base> and <cand> in the results file and exit\n");
     LOG_INFO("\n");
     LOG_INFO("Server specific:\n");
     LOG_INFO("    -s, --server                   run in server mode\n");
     LOG_INFO("\n");
     LOG_INFO("Client specific:\n");
-    LOG_INFO("    -c, --client    <host>         run in client mode, connecting to <host>\n");
+    LOG_INFO("    -c, --client    <host>[,...]   run in client mode, connecting to <host>, one per -B address or one for all\n");
     LOG_INFO("    -w, --window    #              maximum TCP sliding window size (<= %d)\n", MAX_WND);
     LOG_INFO("        --bufsize   #[KMG]         lengof of buffer size to read (default=%s)\n", BUFSIZE);
-    LOG_INFO("    -l, --len       #              the size of packet to be sent (Defaults: 1500 Bytes)\n");
+    LOG_INFO("    -l, --len       #              the size of packet to be sent (Defaults: 1500 Bytes, <= %d),\n", MAX_PKT_SIZE);
+    LOG_INFO("                                   give it to the server too for jumbo frames\n");
     LOG_INFO("    -t, --time      #              time in seconds to transmit for (default 10 secs)\n");
     LOG_INFO("    -n, --num       #[KMG]         number of bytes to transmit (instead of -t)\n");
     LOG_INFO("        --rttnum                   number of packets to transmit in rtt test (Defaults: %d)\n", NUM_PING);
+    LOG_INFO("        --unit      ns|us|ms       unit to report rtt in (Defaults: ns)\n");
+    LOG_INFO("        --verify                   check payload with per-segment CRC32C, TCP only (set on both sides)\n");
     LOG_INFO("    -u, --udp                      use UDP rather than TCP\n");
+    LOG_INFO("        --fct       <cdf>          flow completion time test, flow sizes from websearch|datamining|<file>\n");
+    LOG_INFO("        --load      #              offered load of the fct test, fraction of link speed (Defaults: %.1f)\n", FCT_LOAD);
+    LOG_INFO("        --flows     #              number of flows in the fct test (Defaults: %d)\n", FCT_FLOWS);
+    LOG_INFO("        --rr        #[,#]          request/response test with <req>[,<resp>] Bytes payload (<= %d)\n", RR_MAX_LEN);
+    LOG_INFO("        --inflight  #              outstanding transactions per thread in the rr test (Defaults: 1)\n");
+    LOG_INFO("        --mpps                     small-packet stress test, pre-built UDP frames of -l Bytes (Defaults: %d)\n", PPS_PKT_SIZE);
+    LOG_INFO("        --loopback                 run the server threads in this process, over a net_ring (default) or\n");
+    LOG_INFO("                                   net_memif pair, -c is the address of the server end\n");
+    LOG_INFO("        --sweep     <grid>         run a trial per combination, e.g. rxd=512:2048,burst=16:32:64, and report\n");
+    LOG_INFO("                                   the best one (params: rxd|txd|burst|pool|mcache)\n");
+    LOG_INFO("        --no-steal                 disable work stealing across threads\n");
+    LOG_INFO("        --pattern   <pattern>      payload pattern: zero|random|incompressible|seq (Defaults: zero)\n");
     exit(0);
 }
 
+/**
+ * Parse --encap vxlan[,<vni>]|gre
+ */
+static int
+convert_to_encap(char* str, uint32_t* vni) {
+    if (strcmp(str, "gre") == 0)
+        return ENCAP_GRE;
+    if (strncmp(str, "vxlan", strlen("vxlan")) != 0)
+        return -1;
+    if (str[strlen("vxlan")] == ',')
+        *vni = strtoul(str + strlen("vxlan") + 1, NULL, 0);
+    else if (str[strlen("vxlan")] != '\0')
+        return -1;
+    return (*vni > 0 && *vni < (1 << 24)) ? ENCAP_VXLAN : -1;
+}
+
+static int
+convert_to_pattern(char* str) {
+    if (strcmp(str, "zero") == 0)
+        return PATTERN_ZERO;
+    else if (strcmp(str, "random") == 0)
+        return PATTERN_RANDOM;
+    else if (strcmp(str, "incompressible") == 0)
+        return PATTERN_INCOMP;
+    else if (strcmp(str, "seq") == 0)
+        return PATTERN_SEQ;
+    return -1;
+}
+
+/**
+ * Split a comma-separated list of IP addresses, one per port
+ *
+ * @return
+ *   Number of addresses, -1 if there are more than MAX_PORT
+ */
+static int
+convert_to_ips(char* str, char ips[][LEN_IP_ADDR]) {
+    char temp[MAX_PORT * LEN_IP_ADDR] = {0};
+    strncpy(temp, str, sizeof(temp) - 1);
+    int num = 0;
+    char* rest = temp;
+    char* token;
+    while ((token = strtok_r(rest, ",", &rest))) {
+        if (num == MAX_PORT)
+            return -1;
+        strncpy(ips[num++], token, LEN_IP_ADDR-1);
+    }
+    return num;
+}
+
+static int
+convert_to_steer(char* str) {
+    if (strcmp(str, "auto") == 0)
+        return STEER_AUTO;
+    else if (strcmp(str, "flow") == 0)
+        return STEER_FLOW;
+    else if (strcmp(str, "rss") == 0)
+        return STEER_RSS;
+    return -1;
+}
+
+/**
+ * Parse a Toeplitz key of RSS_KEY_LEN bytes written in hex, ':' separators
+ * are allowed
+ */
+static int
+convert_to_key(char* str, uint8_t* key) {
+    int len = 0;
+    unsigned byte;
+    while (*str != '\0') {
+        if (*str == ':') {
+            str++;
+            continue;
+        }
+        if (len == RSS_KEY_LEN || sscanf(str, "%2x", &byte) != 1 || str[1] == '\0')
+            return -1;
+        key[len++] = byte;
+        str += 2;
+    }
+    return (len == RSS_KEY_LEN) ? 0 : -1;
+}
+
 static uint64_t 
 convert_to_bytes(char* str) {
     uint64_t temp = atoi(str);
@@ -89,6 +224,19 @@ convert_to_bytes(char* str) {
     return temp;
 }
 
+uint32_t
+pool_fit(struct conf_t* conf) {
+    uint32_t room = conf->mbuf_size - RTE_PKTMBUF_HEADROOM;
+    uint32_t segs = (conf->frame_size + room - 1) / room;
+    uint32_t need = (conf->ring_rx + conf->ring_tx + conf->burst_rx + conf->burst_tx) * segs;
+    // Queue 0 of the other ports takes the first thread's pool
+    need += (conf->num_port - 1) * conf->ring_rx * segs;
+    if (conf->is_ring_pair == true)
+        need += rte_align32pow2(conf->ring_rx) * segs;
+    need  = RTE_MAX(need + conf->pool_cache, (uint32_t) (conf->pool_cache * 1.5));
+    return RTE_MAX(rte_align32pow2(need + 1) - 1, (uint32_t) MIN_MBUF_POOL);
+}
+
 int 
 opt_parser(int argc, char** argv) {
     char* app = argv[0];
@@ -96,6 +244,7 @@ opt_parser(int argc, char** argv) {
     if (argc == 1) 
         show_usage(app);
 
+    bool is_burst = false;
     static int lopt = 0;
     static struct option opts[] = {
         {"interval", required_argument, &lopt, 1},
@@ -114,6 +263,35 @@ opt_parser(int argc, char** argv) {
         {"nic",      required_argument, &lopt, 14},
         {"bufsize",  required_argument, &lopt, 15},
         {"rttnum",   required_argument, &lopt, 16},
+        {"unit",     required_argument, &lopt, 17},
+        {"pattern",  required_argument, &lopt, 18},
+        {"verify",   no_argument,       &lopt, 19},
+        {"file",     required_argument, &lopt, 20},
+        {"no-steal", no_argument,       &lopt, 21},
+        {"fct",      required_argument, &lopt, 22},
+        {"load",     required_argument, &lopt, 23},
+        {"flows",    required_argument, &lopt, 24},
+        {"rr",       required_argument, &lopt, 25},
+        {"inflight", required_argument, &lopt, 26},
+        {"mpps",     no_argument,       &lopt, 27},
+        {"pmu",      no_argument,       &lopt, 28},
+        {"results",  required_argument, &lopt, 29},
+        {"tag",      required_argument, &lopt, 30},
+        {"compare",  required_argument, &lopt, 31},
+        {"microburst", required_argument, &lopt, 32},
+        {"steer",    required_argument, &lopt, 33},
+        {"rss-key",  required_argument, &lopt, 34},
+        {"rxd",      required_argument, &lopt, 35},
+        {"txd",      required_argument, &lopt, 36},
+        {"burst",    required_argument, &lopt, 37},
+        {"pool",     required_argument, &lopt, 38},
+        {"mcache",   required_argument, &lopt, 39},
+        {"mbuf-size", required_argument, &lopt, 41},
+        {"vdev",     required_argument, &lopt, 42},
+        {"loopback", no_argument,       &lopt, 43},
+        {"vlan",     required_argument, &lopt, 44},
+        {"encap",    required_argument, &lopt, 45},
+        {"sweep",    required_argument, &lopt, 40},
         {0, 0, 0, 0}
     };
 
@@ -131,11 +309,31 @@ opt_parser(int argc, char** argv) {
     conf->win_size = MAX_WND;
     conf->pkt_size = MTU;
     conf->num_ping = NUM_PING;
+    conf->time_unit= UNIT_NS;
+    conf->pattern  = PATTERN_ZERO;
+    conf->is_steal = true;
+    conf->num_flow = FCT_FLOWS;
+    conf->load     = FCT_LOAD;
+    conf->rr_inflight = 1;
     conf->port_base= DEFAULT_PORT;
     strcpy(conf->rtt_path, "dperf.rtt");
+    strcpy(conf->result_path, RESULT_PATH);
+    strcpy(conf->result_tag, "default");
+    conf->steer = STEER_AUTO;
+    conf->ring_rx    = SIZE_RING_RX;
+    conf->ring_tx    = SIZE_RING_TX;
+    conf->burst_rx   = CLIENT_SIZE_BURST_RX;
+    conf->burst_tx   = CLIENT_SIZE_BURST_TX;
+    conf->is_pool_fit= true;
+    conf->pool_cache = SIZE_MCACHE;
+    conf->vni        = VXLAN_VNI;
+    for (int loop = 0; loop < RSS_KEY_LEN; loop += 2) {
+        conf->rss_key[loop]     = 0x6d;
+        conf->rss_key[loop + 1] = 0x5a;
+    }
 
-    int c, opt_index = 0;
-    while ((c = getopt_long(argc, argv, "i:p:B:N:P:sc:w:l:t:n:uh", opts, &opt_index)) != -1) {
+    int c, ret, opt_index = 0, num_dst = 0;
+    while ((c = getopt_long(argc, argv, "i:p:B:N:P:sc:w:l:t:n:uhF:", opts, &opt_index)) != -1) {
         switch(c) {
         case 0:
             switch(lopt) {
@@ -146,7 +344,8 @@ opt_parser(int argc, char** argv) {
                 conf->port_base = atoi(optarg);
                 break;
             case 3:
-                strncpy(conf->src_ip_str, optarg, LEN_IP_ADDR-1);
+                ret = convert_to_ips(optarg, conf->src_ip_str);
+                conf->num_port = RTE_MAX(ret, 0);
                 break;
             case 4:
                 conf->num_thread = atoi(optarg);
@@ -159,7 +358,7 @@ opt_parser(int argc, char** argv) {
                 break;
             case 7:
                 conf->is_client = true;
-                strncpy(conf->dst_ip_str, optarg, LEN_IP_ADDR-1);
+                num_dst = convert_to_ips(optarg, conf->dst_ip_str);
                 break;
             case 8:
                 conf->win_size = RTE_MIN(atoi(optarg), MAX_WND);
@@ -180,9 +379,10 @@ opt_parser(int argc, char** argv) {
                 show_usage(app);
                 break;
             case 14:
-                if (nic_getip_by_name(optarg, conf->src_ip_str) == -1) {
+                if (nic_getip_by_name(optarg, conf->src_ip_str[0]) == -1) {
                     return 0;
                 }
+                conf->num_port = 1;
                 break;
             case 15:
                 conf->bufsize = convert_to_bytes(optarg);
@@ -190,6 +390,131 @@ opt_parser(int argc, char** argv) {
             case 16:
                 conf->num_ping = atoi(optarg);
                 break;
+            case 17:
+                ret = time_strto_unit(optarg);
+                if (ret < 0) {
+                    LOG_ERRO("Unrecognized time unit %s (ns|us|ms)\n", optarg);
+                    show_usage(app);
+                }
+                conf->time_unit = ret;
+                break;
+            case 18:
+                ret = convert_to_pattern(optarg);
+                if (ret < 0) {
+                    LOG_ERRO("Unrecognized payload pattern %s\n", optarg);
+                    show_usage(app);
+                }
+                conf->pattern = ret;
+                break;
+            case 19:
+                conf->is_verify = true;
+                break;
+            case 20:
+                strncpy(conf->file_path, optarg, LEN_PATH-1);
+                break;
+            case 21:
+                conf->is_steal = false;
+                break;
+            case 22:
+                conf->is_fct = true;
+                strncpy(conf->fct_cdf, optarg, LEN_PATH-1);
+                break;
+            case 23:
+                conf->load = atof(optarg);
+                break;
+            case 24:
+                conf->num_flow = atoi(optarg);
+                break;
+            case 25:
+                conf->is_rr = true;
+                if (sscanf(optarg, "%hu,%hu", &conf->rr_req, &conf->rr_resp) == 1)
+                    conf->rr_resp = conf->rr_req;
+                break;
+            case 26:
+                conf->rr_inflight = RTE_MIN(atoi(optarg), MAX_WND);
+                break;
+            case 27:
+                conf->is_pps = true;
+                break;
+            case 28:
+                conf->is_pmu = true;
+                break;
+            case 29:
+                strncpy(conf->result_path, optarg, LEN_PATH-1);
+                break;
+            case 30:
+                strncpy(conf->result_tag, optarg, LEN_PATH-1);
+                break;
+            case 31:
+                strncpy(conf->compare, optarg, LEN_PATH-1);
+                break;
+            case 32:
+                conf->burst_us = atoi(optarg);
+                break;
+            case 33:
+                ret = convert_to_steer(optarg);
+                if (ret < 0) {
+                    LOG_ERRO("Unrecognized steering %s\n", optarg);
+                    show_usage(app);
+                }
+                conf->steer = ret;
+                break;
+            case 34:
+                if (convert_to_key(optarg, conf->rss_key) != 0) {
+                    LOG_ERRO("--rss-key needs %d bytes in hex\n", RSS_KEY_LEN);
+                    show_usage(app);
+                }
+                break;
+            case 35:
+                conf->ring_rx = atoi(optarg);
+                break;
+            case 36:
+                conf->ring_tx = atoi(optarg);
+                break;
+            case 37:
+                is_burst = true;
+                if (sscanf(optarg, "%hu,%hu", &conf->burst_rx, &conf->burst_tx) == 1)
+                    conf->burst_tx = conf->burst_rx;
+                break;
+            case 38:
+                conf->pool_size = atoi(optarg);
+                conf->is_pool_fit = false;
+                break;
+            case 39:
+                conf->pool_cache = atoi(optarg);
+                break;
+            case 40:
+                strncpy(conf->sweep, optarg, LEN_PATH-1);
+                break;
+            case 41:
+                conf->mbuf_size = atoi(optarg);
+                break;
+            case 42:
+                if (conf->num_vdev == MAX_PORT) {
+                    LOG_ERRO("At most %d --vdev\n", MAX_PORT);
+                    exit(-1);
+                }
+                strncpy(conf->vdev[conf->num_vdev++], optarg, LEN_PATH-1);
+                break;
+            case 43:
+                conf->is_loopback = true;
+                break;
+            case 44:
+                ret = atoi(optarg);
+                if (ret < 1 || ret > 4094) {
+                    LOG_ERRO("--vlan must be in [1, 4094]\n");
+                    exit(-1);
+                }
+                conf->vlan_id = ret;
+                break;
+            case 45:
+                ret = convert_to_encap(optarg, &conf->vni);
+                if (ret < 0) {
+                    LOG_ERRO("Unrecognized encapsulation %s\n", optarg);
+                    show_usage(app);
+                }
+                conf->encap = ret;
+                break;
             default:
                 show_usage(app);
                 break;
@@ -202,12 +527,14 @@ opt_parser(int argc, char** argv) {
             conf->port_base = atoi(optarg);
             break;
         case 'B':
-            strncpy(conf->src_ip_str, optarg, LEN_IP_ADDR-1);
+            ret = convert_to_ips(optarg, conf->src_ip_str);
+            conf->num_port = RTE_MAX(ret, 0);
             break;
         case 'N':
-            if (nic_getip_by_name(optarg, conf->src_ip_str) == -1) {
+            if (nic_getip_by_name(optarg, conf->src_ip_str[0]) == -1) {
                 return 0;
             }
+            conf->num_port = 1;
             break;
         case 'P':
             conf->num_thread = atoi(optarg);
@@ -217,7 +544,7 @@ opt_parser(int argc, char** argv) {
             break;
         case 'c':
             conf->is_client = true;
-            strncpy(conf->dst_ip_str, optarg, LEN_IP_ADDR-1);
+            num_dst = convert_to_ips(optarg, conf->dst_ip_str);
             break;
         case 'w':
             conf->win_size = RTE_MIN(atoi(optarg), MAX_WND);
@@ -234,6 +561,9 @@ opt_parser(int argc, char** argv) {
         case 'u':
             conf->is_udp = true;
             break;
+        case 'F':
+            strncpy(conf->file_path, optarg, LEN_PATH-1);
+            break;
         case 'h':
             show_usage(app);
             break;
@@ -243,6 +573,10 @@ opt_parser(int argc, char** argv) {
         }
     }
 
+    // Offline, needs neither EAL nor a port
+    if (strlen(conf->compare) > 0)
+        exit(result_compare(conf->result_path, conf->compare) == 0 ? 0 : 1);
+
     if (conf->is_server == false && conf->is_client == false) {
         LOG_ERRO("%s\n", "Not specify work mode (-s|-c host)");
         show_usage(app);
@@ -251,57 +585,222 @@ opt_parser(int argc, char** argv) {
         show_usage(app);
     }
 
-    if (strlen(conf->src_ip_str) == 0) {
-        LOG_ERRO("%s\n", "Not specify local host");
+    if (conf->num_port == 0) {
+        LOG_ERRO("Not specify local host, or more than %d of them\n", MAX_PORT);
+        show_usage(app);
+    }
+    if (conf->is_client == true && num_dst != 1 && num_dst != conf->num_port) {
+        LOG_ERRO("-c needs one server address, or one per -B address (%hu)\n", conf->num_port);
         show_usage(app);
     }
+    if (conf->num_thread < conf->num_port) {
+        LOG_ERRO("-P must be at least the number of ports (%hu)\n", conf->num_port);
+        exit(-1);
+    }
+
+    if (conf->is_loopback == true) {
+        if (conf->is_client == false || conf->num_port != 1 || num_dst != 1 || conf->num_vdev > 1 || strlen(conf->file_path) > 0) {
+            LOG_ERRO("--loopback needs -c, one -B address and at most one --vdev, and cannot be combined with -F\n");
+            exit(-1);
+        }
+        if (conf->num_vdev == 0)
+            strcpy(conf->vdev[0], "net_ring");
+        conf->num_vdev = 1;
+        if (strncmp(conf->vdev[0], "net_ring", strlen("net_ring")) != 0 && strncmp(conf->vdev[0], "net_memif", strlen("net_memif")) != 0) {
+            LOG_ERRO("--loopback runs over net_ring or net_memif\n");
+            exit(-1);
+        }
+        // The second port is the server end, it owns the -c address
+        conf->num_port = 2;
+        strcpy(conf->src_ip_str[1], conf->dst_ip_str[0]);
+        strcpy(conf->dst_ip_str[1], conf->src_ip_str[0]);
+        conf->is_ring_pair = (strncmp(conf->vdev[0], "net_ring", strlen("net_ring")) == 0);
+        if (conf->is_ring_pair == false) {
+            // Both ends in this process, the extra arguments go to both
+            char args[LEN_PATH] = {0};
+            strcpy(args, conf->vdev[0] + strlen("net_memif"));
+            snprintf(conf->vdev[0], LEN_PATH, "net_memif0,role=server,id=0%s", args);
+            snprintf(conf->vdev[1], LEN_PATH, "net_memif1,role=client,id=0%s", args);
+            conf->num_vdev = 2;
+        }
+    } else if (conf->num_vdev > 0) {
+        if (conf->num_vdev != conf->num_port) {
+            LOG_ERRO("--vdev must be given once per -B address (%hu)\n", conf->num_port);
+            exit(-1);
+        }
+        // EAL names a virtual device after the driver and a unique suffix
+        for (uint16_t loop = 0; loop < conf->num_vdev; loop++) {
+            char spec[LEN_PATH] = {0};
+            char* args = strchr(conf->vdev[loop], ',');
+            int len = (args == NULL) ? (int) strlen(conf->vdev[loop]) : (int) (args - conf->vdev[loop]);
+            snprintf(spec, LEN_PATH, "%.*s%hu%s", len, conf->vdev[loop], loop, args == NULL ? "" : args);
+            strcpy(conf->vdev[loop], spec);
+        }
+    }
 
     struct in_addr s_addr;
-    inet_aton(conf->src_ip_str, &s_addr);
-    conf->src_ip = s_addr.s_addr;
+    for (int loop = 0; loop < conf->num_port; loop++) {
+        inet_aton(conf->src_ip_str[loop], &s_addr);
+        conf->src_ip[loop] = s_addr.s_addr;
+        if (conf->is_client == true) {
+            // One server address serves all ports
+            if (num_dst == 1 && loop > 0 && conf->is_loopback == false)
+                strcpy(conf->dst_ip_str[loop], conf->dst_ip_str[0]);
+            inet_aton(conf->dst_ip_str[loop], &s_addr);
+            conf->dst_ip[loop] = s_addr.s_addr;
+        }
+    }
 
-    if (conf->is_client == true) {
-        inet_aton(conf->dst_ip_str, &s_addr);
-        conf->dst_ip = s_addr.s_addr;
+    conf->is_file = (strlen(conf->file_path) > 0);
+    // The server only rebuilds the file from TCP payloads
+    if (conf->is_file == true && conf->is_udp == true) {
+        LOG_ERRO("-F cannot be used with -u\n");
+        exit(-1);
+    }
+    if (conf->is_file == true && conf->is_client == true) {
+        struct stat st;
+        if (stat(conf->file_path, &st) != 0 || st.st_size == 0) {
+            LOG_ERRO("Cannot read %s or it is empty\n", conf->file_path);
+            exit(-1);
+        }
+        // The whole file is transmitted once, split across all threads
+        conf->data_size = st.st_size;
+        // The server rebuilds the file from the chunk-to-thread mapping
+        conf->is_steal  = false;
+        if (conf->is_verify == true) {
+            LOG_WARN("Payload verification is not supported with -F, ignore --verify\n");
+            conf->is_verify = false;
+        }
+    }
+
+    if (conf->is_fct == true && conf->is_client == true) {
+        if (fct_load_cdf(conf->fct_cdf) != 0)
+            exit(-1);
+        if (conf->load <= 0 || conf->load > 1 || conf->num_flow == 0) {
+            LOG_ERRO("--load must be in (0, 1] and --flows must be positive\n");
+            exit(-1);
+        }
+        // Flows replace the bulk transfer
+        conf->data_size = 0;
+        conf->is_file   = false;
+    }
+
+    if (conf->is_rr == true && conf->is_client == true) {
+        if (conf->rr_resp == 0 || conf->rr_req > RR_MAX_LEN || conf->rr_resp > RR_MAX_LEN || conf->rr_inflight == 0) {
+            LOG_ERRO("--rr sizes must be in [1, %d] (response) / [0, %d] (request), --inflight positive\n", RR_MAX_LEN, RR_MAX_LEN);
+            exit(-1);
+        }
+        if (conf->is_udp == true || conf->is_rtt == true || conf->is_fct == true || conf->is_file == true) {
+            LOG_ERRO("--rr cannot be combined with -u, --rtt, --fct or -F\n");
+            exit(-1);
+        }
+        // Transactions replace the bulk transfer, the test runs for -t
+        conf->data_size = 0;
+        conf->is_verify = false;
+    }
+
+    // Below 10us the port counters read costs as much as the period
+    if (conf->burst_us > 0 && (conf->burst_us < 10 || conf->burst_us > 1000)) {
+        LOG_ERRO("--microburst must be in [10, 1000] us\n");
+        exit(-1);
+    }
+
+    if (conf->is_pps == true && conf->is_client == true) {
+        if (conf->is_rtt == true || conf->is_rr == true || conf->is_fct == true || conf->is_file == true) {
+            LOG_ERRO("--mpps cannot be combined with --rtt, --rr, --fct or -F\n");
+            exit(-1);
+        }
+        // -l counts the FCS, as line-rate figures do
+        if (conf->pkt_size == MTU)
+            conf->pkt_size = PPS_PKT_SIZE;
+        if (conf->pkt_size < RTE_ETHER_MIN_LEN || conf->pkt_size > MTU) {
+            LOG_ERRO("-l must be in [%d, %d] with --mpps\n", RTE_ETHER_MIN_LEN, MTU);
+            exit(-1);
+        }
+        // Longer bursts amortize the doorbell of min-size frames
+        if (is_burst == false)
+            conf->burst_tx = PPS_SIZE_BURST_TX;
+        // Frames are sent for -t, the payload is not taken from tasks
+        conf->is_udp    = true;
+        conf->data_size = 0;
+        conf->is_verify = false;
+    }
+
+    if (conf->pkt_size > MAX_PKT_SIZE) {
+        LOG_ERRO("-l must be at most %d Bytes (9000 Bytes MTU)\n", MAX_PKT_SIZE);
+        exit(-1);
+    }
+    // -l is the inner frame, the tag and the outer headers come on top
+    conf->encap_len = (conf->vlan_id > 0 ? VLAN_TAG_LEN : 0) +
+        (conf->encap == ENCAP_VXLAN ? ENCAP_VXLAN_LEN : conf->encap == ENCAP_GRE ? ENCAP_GRE_LEN : 0);
+    // Largest frame of the threads: clients send -l frames (requests with
+    // --rr, probes with --rtt) and get ACKs or responses back, servers receive
+    // -l frames and may reply with a full response
+    uint16_t frame = conf->pkt_size;
+    if (conf->is_client == true && conf->is_rr == true)
+        frame = RTE_ETHER_HDR_LEN + 40 + RTE_MAX(conf->rr_req, conf->rr_resp);
+    else if (conf->is_client == true && conf->is_rtt == true)
+        frame = RTE_ETHER_MIN_LEN - RTE_ETHER_CRC_LEN;
+    if (conf->is_server == true || conf->is_loopback == true)
+        frame = RTE_MAX(conf->pkt_size, RTE_MAX(frame, RTE_ETHER_HDR_LEN + 40 + RR_MAX_LEN));
+    conf->frame_size = RTE_MAX(frame + conf->encap_len + RTE_ETHER_CRC_LEN, RTE_ETHER_MIN_LEN);
+    // The data room fits that frame, small frames keep the working set in the
+    // LLC. A smaller --mbuf-size chains segments (scatter RX, multi-segment TX).
+    if (conf->mbuf_size == 0) {
+        conf->mbuf_size = RTE_PKTMBUF_HEADROOM + RTE_ALIGN_CEIL(conf->frame_size, RTE_CACHE_LINE_SIZE);
+    } else if (conf->mbuf_size < RTE_PKTMBUF_HEADROOM + RTE_ETHER_MIN_LEN) {
+        LOG_ERRO("--mbuf-size must be at least %d Bytes\n", RTE_PKTMBUF_HEADROOM + RTE_ETHER_MIN_LEN);
+        exit(-1);
+    }
+
+    if (conf->burst_rx == 0 || conf->burst_rx > MAX_SIZE_BURST || conf->burst_tx == 0 || conf->burst_tx > MAX_SIZE_BURST) {
+        LOG_ERRO("--burst must be in [1, %d]\n", MAX_SIZE_BURST);
+        exit(-1);
+    }
+    if (conf->is_pool_fit == true)
+        conf->pool_size = pool_fit(conf);
+    else if (conf->pool_size < pool_fit(conf))
+        LOG_WARN("--pool %u may run dry, the rings, bursts and cache of a thread hold up to %u mbufs\n", conf->pool_size, pool_fit(conf));
+    // A cache above pool/1.5 leaves the other lcores with no mbuf
+    if (conf->ring_rx == 0 || conf->ring_tx == 0 || conf->pool_cache > RTE_MEMPOOL_CACHE_MAX_SIZE || conf->pool_cache * 1.5 > conf->pool_size) {
+        LOG_ERRO("--rxd/--txd must be positive, --mcache at most %d and %.0f%% of --pool\n", RTE_MEMPOOL_CACHE_MAX_SIZE, 100 / 1.5);
+        exit(-1);
+    }
+
+    if (strlen(conf->sweep) > 0) {
+        if (conf->is_client == false || conf->is_rtt == true || conf->is_fct == true || conf->is_file == true || conf->data_size > 0 || conf->is_pmu == true || conf->burst_us > 0) {
+            LOG_ERRO("--sweep is a timed client test, it cannot be combined with -s, --rtt, --fct, -F, -n, --pmu or --microburst\n");
+            exit(-1);
+        }
+        if (sweep_parse(conf->sweep) < 0)
+            exit(-1);
+    }
+
+    if (conf->is_verify == true && conf->is_udp == true) {
+        LOG_WARN("Payload verification is only supported over TCP, ignore --verify\n");
+        conf->is_verify = false;
     }
 
     if (conf->data_size > 0)
         conf->bufsize = RTE_MIN(conf->bufsize, conf->data_size);
-    conf->total_lcore = conf->num_thread + 1;
+    // With --loopback every client thread has a server thread
+    conf->total_lcore = conf->num_thread * (conf->is_loopback ? 2 : 1) + 1;
 
     return 0;
 }
 
-int opt_genargv(char* app, char** my_argv) {
-    int my_argc = 0;
-    strcpy(my_argv[my_argc++], app);
-    strcpy(my_argv[my_argc++], "-c");
-    int ret = 0;
+/**
+ * NUMA node of the NIC owning `ip_addr`
+ */
+static int
+nic_getnumanode_by_ip(char* ip_addr) {
     int numa_node = 0;
     char* nic_name = NULL;
     char* businfo  = NULL;
-    char* cpu_list = NULL;
-    char* cpu_mask = NULL;
-    struct conf_t* conf = get_conf();
-    if (nic_getname_by_ip(conf->src_ip_str, &nic_name) == 0) {
+    if (nic_getname_by_ip(ip_addr, &nic_name) == 0) {
         if (nic_getbusinfo_by_name(nic_name, &businfo) == 0) {
             numa_node = nic_getnumanode_by_businfo(businfo);
-            if (numa_node >= 0) {
-                ret = nic_getcpus_by_numa(numa_node, &cpu_list);
-                if (ret == 0) {
-                    ret = cpu_getmask(cpu_list, conf->num_thread+1, &cpu_mask);
-                    if (ret > 0) {
-                        strcpy(my_argv[my_argc++], cpu_mask);
-                        free(cpu_mask);
-                    } else {
-                        LOG_ERRO("Cannot allocate CPU cores\n");
-                        exit(-1);
-                    }
-                } else {
-                    LOG_ERRO("Cannot read CPU core list\n");
-                    exit(-1);
-                }
-            } else {
+            if (numa_node < 0) {
                 LOG_ERRO("Cannot get NUMA node index\n");
                 exit(-1);
             }
@@ -312,16 +811,162 @@ int opt_genargv(char* app, char** my_argv) {
         }
         free(nic_name);
     } else {
-        LOG_ERRO("Cannot find device for %s\n", conf->src_ip_str);
+        LOG_ERRO("Cannot find device for %s\n", ip_addr);
         exit(-1);
     }
+    return numa_node;
+}
+
+/**
+ * Port index of thread `id`. The mapping depends on -P and the -B order only,
+ * so that client and server agree on it whatever their NUMA layout: thread
+ * i > 0 is on port (i - 1) % num_port, with --loopback the client threads on
+ * the first end of the pair and the server threads on the other.
+ */
+static uint16_t
+conn_port_index(uint16_t id) {
+    struct conf_t* conf = get_conf();
+    if (id == 0)
+        return 0;
+    if (conf->is_loopback == true)
+        return (id > conf->num_thread) ? 1 : 0;
+    return (id - 1) % conf->num_port;
+}
+
+/**
+ * OR the hex core mask `src` into `dst`, both are "0x..." strings
+ */
+static void
+mask_or(char* dst, const char* src) {
+    char temp[LEN_MASK] = {0};
+    int len_dst = strlen(dst) - 2, len_src = strlen(src) - 2;
+    int len = RTE_MAX(len_dst, len_src);
+    strcpy(temp, "0x");
+    for (int loop = 0; loop < len; loop++) {
+        int pos_dst = len_dst - len + loop, pos_src = len_src - len + loop;
+        char a = pos_dst >= 0 ? dst[2 + pos_dst] : '0';
+        char b = pos_src >= 0 ? src[2 + pos_src] : '0';
+        int sum = (isdigit(a) ? a - '0' : a - 'a' + 10) | (isdigit(b) ? b - '0' : b - 'a' + 10);
+        temp[2 + loop] = (sum <= 9) ? (char) (sum + '0') : (char) (sum - 10 + 'a');
+    }
+    strcpy(dst, temp);
+}
+
+/**
+ * Print the CPU of every thread, thread 0 is the main lcore
+ */
+static void
+print_cpus(struct cpu_slot_t* slots, int* nodes, int num_slot) {
+    LOG_LINE(75, '-', "CPU Placement");
+    LOG_INFO("Thread  CPU   Node  Core  Port  Flags\n");
+    for (int loop = 0; loop < num_slot; loop++) {
+        LOG_INFO("  %02d    %-4d  %-4d  %-4d  %-4hu  %s%s%s\n", loop, slots[loop].cpu, nodes[loop], slots[loop].core, conn_port_index(loop),
+            (loop == 0) ? "main " : "",
+            slots[loop].is_reserved ? "isolated " : "",
+            slots[loop].is_shared ? CO_RED"SMT shared"CO_RESET : "");
+    }
+    LOG_LINE(75, '-', NULL);
+}
+
+int opt_genargv(char* app, char** my_argv) {
+    int my_argc = 0;
+    strcpy(my_argv[my_argc++], app);
+    strcpy(my_argv[my_argc++], "-c");
+    int ret = 0;
+    char* cpu_mask = NULL;
+    struct conf_t* conf = get_conf();
+
+    // Each thread runs on the NUMA node of its port (see conn_port_index()),
+    // the main lcore next to the first port. Virtual devices have no NIC to
+    // look up, they live on node 0
+    int port_node[MAX_PORT] = {0};
+    for (int loop = 0; loop < conf->num_port; loop++) {
+        port_node[loop] = (conf->num_vdev > 0) ? 0 : nic_getnumanode_by_ip(conf->src_ip_str[loop]);
+        if (port_node[loop] >= MAX_NUMA) {
+            LOG_ERRO("Cannot get NUMA node index\n");
+            exit(-1);
+        }
+    }
+    int cores[MAX_NUMA] = {0};
+    int nodes[MAX_LCORE];
+    int main_node = port_node[0];
+    for (uint16_t loop = 0; loop < conf->total_lcore; loop++) {
+        nodes[loop] = port_node[conn_port_index(loop)];
+        cores[nodes[loop]]++;
+    }
+
+    // One physical core per lcore where possible, see cpu_place(). The CPUs
+    // of a node go to its threads in thread order, slot 0 is the main lcore.
+    struct cpu_slot_t slots[MAX_LCORE];
+    struct cpu_slot_t node_slots[MAX_LCORE];
+    char core_mask[LEN_MASK] = "0x0";
+    for (int numa_node = 0; numa_node < MAX_NUMA; numa_node++) {
+        if (cores[numa_node] == 0)
+            continue;
+        bool has_main = (numa_node == main_node);
+        ret = cpu_place(numa_node, cores[numa_node] - has_main, has_main, node_slots);
+        if (ret < cores[numa_node]) {
+            LOG_ERRO("NUMA node %d has %d usable CPUs for %d lcores\n", numa_node, ret, cores[numa_node]);
+            exit(-1);
+        }
+        int next = 0;
+        for (uint16_t loop = 0; loop < conf->total_lcore; loop++) {
+            if (nodes[loop] != numa_node)
+                continue;
+            slots[loop] = node_slots[next++];
+            conf->thread_lcore[loop] = slots[loop].cpu;
+
+            char cpu_str[16];
+            sprintf(cpu_str, "%d", slots[loop].cpu);
+            if (cpu_getmask(cpu_str, 1, &cpu_mask) != 1) {
+                LOG_ERRO("Cannot allocate CPU %d\n", slots[loop].cpu);
+                exit(-1);
+            }
+            mask_or(core_mask, cpu_mask);
+            free(cpu_mask);
+        }
+    }
+    print_cpus(slots, nodes, conf->total_lcore);
+    strcpy(my_argv[my_argc++], core_mask);
+    strcpy(my_argv[my_argc++], "--main-lcore");
+    sprintf(my_argv[my_argc++], "%d", slots[0].cpu);
     strcpy(my_argv[my_argc++], "-n");
     strcpy(my_argv[my_argc++], "4");
-    // TODO --socket-mem
-    strcpy(my_argv[my_argc++], "--socket-mem=0,8192");
+    if (conf->num_vdev > 0) {
+        // No NIC and no hugepages needed, e.g., on a dev box or in CI
+        strcpy(my_argv[my_argc++], "--no-pci");
+        strcpy(my_argv[my_argc++], "--no-huge");
+        strcpy(my_argv[my_argc++], "-m");
+        strcpy(my_argv[my_argc++], VDEV_MEM);
+        // The ring pair of --loopback is created by the application
+        for (int loop = 0; loop < conf->num_vdev && conf->is_ring_pair == false; loop++)
+            sprintf(my_argv[my_argc++], "--vdev=%s", conf->vdev[loop]);
+    } else {
+        // Hugepages on the nodes of the ports only: the pools of the threads,
+        // and the task buffers next to the first port. A sweep needs the
+        // largest pool of its grid, twice since port_reconfigure() creates
+        // the new pools before it frees the old ones.
+        uint64_t pool_size = (strlen(conf->sweep) > 0) ? 2 * (uint64_t) RTE_MAX(sweep_max_pool(), conf->pool_size) : conf->pool_size;
+        uint64_t mem[MAX_NUMA] = {0};
+        int max_node = 0;
+        for (int numa_node = 0; numa_node < MAX_NUMA; numa_node++) {
+            if (cores[numa_node] == 0)
+                continue;
+            mem[numa_node] = (uint64_t) cores[numa_node] * pool_size * (conf->mbuf_size + MBUF_OVERHEAD);
+            max_node = numa_node;
+        }
+        if (conf->is_client == true && conf->is_rtt == false && conf->is_rr == false && conf->is_pps == false && conf->is_file == false)
+            mem[main_node] += (uint64_t) conf->num_thread * TASK_DEPTH * conf->bufsize;
+        char* arg = my_argv[my_argc++];
+        arg += sprintf(arg, "--socket-mem=");
+        for (int numa_node = 0; numa_node <= max_node; numa_node++) {
+            uint64_t mb = (cores[numa_node] == 0) ? 0 : (mem[numa_node] + (1 << 20) - 1) / (1 << 20) + SOCKET_MEM_BASE;
+            arg += sprintf(arg, (numa_node == 0) ? "%lu" : ",%lu", mb);
+        }
+        strcpy(my_argv[my_argc++], "--huge-unlink");
+    }
     strcpy(my_argv[my_argc++], "-d");
     strcpy(my_argv[my_argc++], "librte_mempool.so");
-    strcpy(my_argv[my_argc++], "--huge-unlink");
     strcpy(my_argv[my_argc++], "--log-level=4");
 
     return my_argc;
@@ -332,7 +977,7 @@ void print_conn(void) {
     struct conf_t* conf = get_conf();
     LOG_LINE(90, '-', "Thread Configuration");
     LOG_INFO("ID       SRC MAC           DST MAC         SRC IP     DST IP     Q  P   C \n");
-    for (uint16_t loop = 0; loop <= conf->num_thread; loop++) {
+    for (uint16_t loop = 0; loop < conf->total_lcore; loop++) {
         struct conn_t* conn = &(conf->conn[loop]);
         LOG_INFO("%02u  %02"PRIx8":%02"PRIx8":%02"PRIx8":%02"PRIx8":%02"PRIx8":%02"PRIx8" %02"PRIx8":%02"PRIx8":%02"PRIx8":%02"PRIx8":%02"PRIx8":%02"PRIx8"  0x%08x 0x%08x  %02hu  %hu  %02u  %s\n",
             conn->ID,
@@ -347,63 +992,146 @@ void print_conn(void) {
             conn->mbuf_pool->name
         );
     }
+    if (conf->encap_len > 0) {
+        char tunnel[32] = "no tunnel";
+        if (conf->encap == ENCAP_VXLAN)
+            sprintf(tunnel, "VXLAN (VNI %u)", conf->vni);
+        else if (conf->encap == ENCAP_GRE)
+            strcpy(tunnel, "GRE (key = thread port)");
+        LOG_INFO("Encapsulation: %s, VLAN %hu, %hu Bytes in front of the %hu Bytes inner frame\n",
+            tunnel, conf->vlan_id, conf->encap_len, conf->pkt_size);
+    }
     LOG_LINE(90, '-', NULL);
 }
 
+/**
+ * Memory footprint of the mbuf pools on each NUMA node
+ */
+static void
+print_pools(void) {
+    struct conf_t* conf = get_conf();
+    uint64_t bytes[MAX_NUMA] = {0};
+    uint16_t pools[MAX_NUMA] = {0};
+    for (uint16_t loop = 0; loop < conf->total_lcore; loop++) {
+        struct rte_mempool* mp = conf->conn[loop].mbuf_pool;
+        int node = (mp->socket_id >= 0 && mp->socket_id < MAX_NUMA) ? mp->socket_id : 0;
+        bytes[node] += (uint64_t) mp->size * (mp->header_size + mp->elt_size + mp->trailer_size);
+        pools[node]++;
+    }
+    LOG_INFO("Mbuf pools: %u mbufs per thread (%s), %hu Bytes data room for %hu Bytes frames\n",
+        conf->pool_size, conf->is_pool_fit ? "fitted to rings, bursts and cache" : "--pool",
+        rte_pktmbuf_data_room_size(conf->conn[0].mbuf_pool), conf->frame_size);
+    for (int node = 0; node < MAX_NUMA; node++) {
+        if (pools[node] > 0)
+            LOG_INFO("  node %d: %hu pools, %.1f MB\n", node, pools[node], bytes[node] / 1e6);
+    }
+}
+
 void init_conn(void) {
     struct conf_t* conf = get_conf();
 
     int ret = 0;
     char* nic_name = NULL;
     char* businfo  = NULL;
-    if (nic_getname_by_ip(conf->src_ip_str, &nic_name) == 0) {
-        if (nic_getbusinfo_by_name(nic_name, &businfo) == 0) {
-            for (uint16_t loop = 0; loop <= conf->num_thread; loop++) {
-                ret = rte_eth_dev_get_port_by_name(businfo, &conf->port_id);
-                rte_eth_macaddr_get(conf->port_id, &conf->conn[loop].src_mac);
-                conf->conn[loop].src_addr = conf->src_ip;
-                conf->conn[loop].src_port = htons(conf->port_base + loop);
-                conf->conn[loop].port_id = conf->port_id;
-                conf->conn[loop].queue_id = loop;
-                conf->conn[loop].is_rtt   = conf->is_rtt;
-
-                char mbuf_pool_name[20];
-                sprintf(mbuf_pool_name, "MBUF_POOL_%hu", loop);
-                conf->conn[loop].mbuf_pool= rte_pktmbuf_pool_create(mbuf_pool_name, SIZE_MBUF_POOL, SIZE_MCACHE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
-                if (conf->conn[loop].mbuf_pool == NULL) {
-                    LOG_ERRO("Cannot create mbuf pool %s\n", mbuf_pool_name);
+    for (uint16_t loop = 0; loop < conf->num_port && conf->num_vdev == 0; loop++) {
+        if (nic_getname_by_ip(conf->src_ip_str[loop], &nic_name) == 0) {
+            if (nic_getbusinfo_by_name(nic_name, &businfo) == 0) {
+                ret = rte_eth_dev_get_port_by_name(businfo, &conf->ports[loop]);
+                if (ret != 0) {
+                    LOG_ERRO("Cannot find the port of %s (%s)\n", nic_name, businfo);
                     exit(-1);
                 }
+                free(businfo);
+            } else {
+                LOG_ERRO("Cannot read the businfo of %s\n", nic_name);
+                exit(-1);
             }
-            free(businfo);
+            free(nic_name);
         } else {
-            LOG_ERRO("Cannot read the businfo of %s\n", nic_name);
+            LOG_ERRO("Cannot find device for %s\n", conf->src_ip_str[loop]);
             exit(-1);
         }
-        free(nic_name);
-    } else {
-        LOG_ERRO("Cannot find device for %s\n", conf->src_ip_str);
+    }
+    if (conf->num_vdev > 0 && init_vdev() != 0)
+        exit(-1);
+    // Queue 0 of every port belongs to the main lcore
+    for (uint16_t loop = 0; loop < conf->num_port; loop++)
+        conf->num_queue[loop] = 1;
+    conf->port_id = conf->ports[0];
+
+    // Every thread runs on the lcore opt_genargv() picked next to its port,
+    // thread 0 is the main lcore
+    for (uint16_t loop = 0; loop < conf->total_lcore; loop++) {
+        conf->conn[loop].ID = loop;
+        conf->conn[loop].lcore_id = conf->thread_lcore[loop];
+    }
+    if (conf->conn[0].lcore_id != rte_get_main_lcore()) {
+        LOG_ERRO("The main lcore is %u, not the CPU %u picked for it\n", rte_get_main_lcore(), conf->conn[0].lcore_id);
         exit(-1);
     }
 
-    if (conf->is_client == true) {
-        for (uint16_t loop = 0; loop <= conf->num_thread; loop++) {
-            char nexthop_ip_str[LEN_IP_ADDR];  
-            uint32_t nexthop_ip = get_ip_nexthop(conf->dst_ip);
-            ip_to_str(nexthop_ip, nexthop_ip_str);
-            conf->conn[loop].dst_mac = nic_getarp_by_ip(nexthop_ip_str);
-            conf->conn[loop].dst_addr = conf->dst_ip;
-            conf->conn[loop].dst_port = htons(conf->port_base + loop);
-            conf->conn[loop].pkt_size = conf->pkt_size;
+    // Threads are dealt over the ports in -B order, see conn_port_index(),
+    // and take the next queue of their port. With --loopback, server thread
+    // i takes the queue of client thread i on the other end of the pair.
+    for (uint16_t loop = 0; loop < conf->total_lcore; loop++) {
+        struct conn_t* conn = &conf->conn[loop];
+        uint16_t port_index = conn_port_index(loop);
+        conn->is_server  = (conf->is_loopback == true && loop > conf->num_thread);
+        conn->port_index = port_index;
+        conn->port_id    = conf->ports[port_index];
+        conn->queue_id   = (loop == 0) ? 0 : conf->num_queue[port_index]++;
+        rte_eth_macaddr_get(conn->port_id, &conn->src_mac);
+        conn->src_addr = conf->src_ip[port_index];
+        conn->src_port = htons(conf->port_base + loop);
+        conn->is_rtt   = conf->is_rtt;
+        conn->encap    = conf->encap;
+        conn->vlan_id  = conf->vlan_id;
+        conn->encap_len= conf->encap_len;
+        conn->vni      = conf->vni;
+
+        char mbuf_pool_name[20];
+        sprintf(mbuf_pool_name, "MBUF_POOL_%hu", loop);
+        conn->mbuf_pool = port_pool_create(mbuf_pool_name, port_index);
+        if (conn->mbuf_pool == NULL) {
+            LOG_ERRO("Cannot create mbuf pool %s\n", mbuf_pool_name);
+            exit(-1);
         }
     }
 
-    unsigned lcore_id;
-    uint16_t index = 0;
-    RTE_LCORE_FOREACH(lcore_id) {
-        conf->conn[index].ID = index;
-        conf->conn[index++].lcore_id = lcore_id;
+    if (conf->is_client == true) {
+        struct rte_ether_addr dst_mac[MAX_PORT];
+        for (uint16_t loop = 0; loop < conf->num_port; loop++) {
+            if (conf->is_loopback == true) {
+                rte_eth_macaddr_get(conf->ports[1], &dst_mac[loop]);
+            } else if (conf->num_vdev > 0) {
+                // No neighbour table behind a virtual device
+                memset(&dst_mac[loop], 0xff, sizeof(struct rte_ether_addr));
+            } else {
+                // Ports towards the same destination share one route/ARP lookup
+                uint16_t prev = 0;
+                while (prev < loop && conf->dst_ip[prev] != conf->dst_ip[loop])
+                    prev++;
+                if (prev < loop) {
+                    dst_mac[loop] = dst_mac[prev];
+                    continue;
+                }
+                char nexthop_ip_str[LEN_IP_ADDR];
+                uint32_t nexthop_ip = get_ip_nexthop(conf->dst_ip[loop]);
+                ip_to_str(nexthop_ip, nexthop_ip_str);
+                dst_mac[loop] = nic_getarp_by_ip(nexthop_ip_str);
+                if (rte_is_broadcast_ether_addr(&dst_mac[loop]))
+                    LOG_WARN("No ARP entry for %s, frames are sent to the broadcast MAC\n", nexthop_ip_str);
+            }
+        }
+        for (uint16_t loop = 0; loop <= conf->num_thread; loop++) {
+            struct conn_t* conn = &conf->conn[loop];
+            conn->dst_mac  = dst_mac[conn->port_index];
+            conn->dst_addr = conf->dst_ip[conn->port_index];
+            conn->dst_port = htons(conf->port_base + loop);
+            conn->pkt_size = conf->pkt_size;
+        }
     }
 
+    print_pools();
     print_conn();
 }
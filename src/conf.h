@@ -23,41 +23,61 @@
  */
 #define SIZE_LINK_OVERHEAD    20
 /**
- * The number of elements in the mbuf pool
+ * Least number of elements in the mbuf pool of a thread when it is fitted to
+ * the rings, bursts and cache (no --pool), 2^n - 1 is optimal for rte_mempool
  */
-#define SIZE_MBUF_POOL        8192 // > MAX_WND
+#define MIN_MBUF_POOL         1023
 /**
- * Size of the per-core object cache
+ * Size of the per-core object cache, default of --mcache
  */
 #define SIZE_MCACHE           512
 /**
- * The number of transmit descriptors to allocate for the transmit ring.
+ * The number of transmit descriptors to allocate for the transmit ring,
+ * default of --txd.
  *
  * See  struct rte_eth_desc_lim for the HW descriptor ring limitations
  */
 #define SIZE_RING_TX          2048
 /**
- * The number of receive descriptors to allocate for the receive ring.
+ * The number of receive descriptors to allocate for the receive ring,
+ * default of --rxd.
  */
 #define SIZE_RING_RX          2048
 /**
- * The maximum number of packets to transmit
+ * The maximum number of packets to transmit, default of --burst
  */
 #define CLIENT_SIZE_BURST_TX  32
 #define SERVER_SIZE_BURST_TX  32
 /**
- * The maximum number of packets to receive
+ * The maximum number of packets to receive, default of --burst
  */
 #define CLIENT_SIZE_BURST_RX  32
 #define SERVER_SIZE_BURST_RX  32
+/**
+ * Upper bound of --burst, sizes the mbuf arrays of the threads
+ */
+#define MAX_SIZE_BURST        512
 // Max length of path
 #define LEN_PATH              200
 // Max length of ip address
 #define LEN_IP_ADDR           20
 // Max length of an argument
-#define LEN_ARGV              32
+#define LEN_ARGV              (LEN_PATH + 8)
+// Memory (MB) of EAL without hugepages, with --vdev
+#define VDEV_MEM              "2048"
+// Hugepage memory (MB) of a NUMA node on top of its pools and task buffers,
+// for rings, the task pool and the PMDs
+#define SOCKET_MEM_BASE       512
+// Overhead of an mbuf in its pool (struct rte_mbuf and the mempool header)
+#define MBUF_OVERHEAD         192
 // Max number of lcores allocated to DPDK
 #define MAX_LCORE             64
+// Max number of ports driven by one process, one per -B address
+#define MAX_PORT              4
+// Max number of NUMA nodes
+#define MAX_NUMA              8
+// Max length of a hex core mask, "0x" + 1024 cores
+#define LEN_MASK              264
 // Max number of items in my_argv
 #define MAX_ARGC              64
 // Max size of sliding window
@@ -65,7 +85,80 @@
 #define DEFAULT_PORT          5000
 // Task size (bytes)
 #define BUFSIZE               "2M"  // ??? ??? ??? ???
+/**
+ * Number of task buffers per thread (one being sent, one queued). Buffers are
+ * recycled once sent, so memory is bounded by num_thread * TASK_DEPTH * bufsize
+ */
+#define TASK_DEPTH            2
 #define MTU                   1500
+/**
+ * Largest -l, Ethernet header and a 9000 Bytes IP MTU (jumbo frames)
+ */
+#define MAX_PKT_SIZE          9014
+/**
+ * Payload patterns of task buffers
+ *   zero:           all bytes are 0
+ *   random:         xorshift stream, identical in every buffer
+ *   incompressible: xorshift stream, unique across buffers
+ *   seq:            every 8-byte word carries its offset in the buffer
+ */
+#define PATTERN_ZERO          0
+#define PATTERN_RANDOM        1
+#define PATTERN_INCOMP        2
+#define PATTERN_SEQ           3
+/**
+ * Default number of flows and offered load of the FCT test (--fct)
+ */
+#define FCT_FLOWS             10000
+#define FCT_LOAD              0.5
+/**
+ * Max request/response size of the RR test (--rr), one segment each way
+ */
+#define RR_MAX_LEN            (MTU - 40)
+/**
+ * Small-packet stress test (--mpps): TX burst, per-thread pool of pre-built
+ * frames (2^n - 1 is optimal for rte_mempool) and its per-lcore cache
+ */
+#define PPS_SIZE_BURST_TX     64
+#define PPS_SIZE_POOL         16383
+#define PPS_SIZE_MCACHE       512
+#define PPS_PKT_SIZE          64
+/**
+ * Steering of each thread's flow to its RX queue (--steer)
+ *   auto: rte_flow rules on the TCP destination port, RSS if the PMD rejects them
+ *   flow: rte_flow rules only
+ *   rss:  RSS with a Toeplitz key and a RETA spreading over the worker queues
+ */
+#define STEER_AUTO            0
+#define STEER_FLOW            1
+#define STEER_RSS             2
+/**
+ * Encapsulation of the frames (--encap). The inner frame is the plain one,
+ * the outer headers carry the same MACs and IPs.
+ *   vxlan: outer UDP to port 4789, the outer source port steers the flow
+ *   gre:   Ethernet over GRE with a key, the key steers the flow
+ */
+#define ENCAP_NONE            0
+#define ENCAP_VXLAN           1
+#define ENCAP_GRE             2
+/**
+ * Bytes in front of the inner frame: Ethernet + IPv4 + UDP + VXLAN and
+ * Ethernet + IPv4 + GRE + key, plus an 802.1Q tag with --vlan
+ */
+#define ENCAP_VXLAN_LEN       50
+#define ENCAP_GRE_LEN         42
+#define VLAN_TAG_LEN          4
+// Default VXLAN network identifier
+#define VXLAN_VNI             1
+/**
+ * Length of the Toeplitz key (--rss-key). The default 0x6d5a key is symmetric,
+ * a flow and its reverse hash to the same RETA entry on both hosts.
+ */
+#define RSS_KEY_LEN           40
+/**
+ * Initial value of the per-segment CRC32C (--verify)
+ */
+#define CRC_SEED              0xffffffff
 // RTT TEST
 /**
  * Number of ping packet for rtt measurement
@@ -82,9 +175,17 @@
 
 struct conn_t {
     bool is_rtt;
+    bool is_server;            // Runs lcore_server, the server half of --loopback
     uint16_t port_id;
+    uint16_t port_index;       // Index of the port in conf->ports
     uint16_t queue_id;
     uint16_t pkt_size;
+    /* Encapsulation */
+    uint8_t  encap;            // Tunnel of the frames, ENCAP_XX
+    uint16_t vlan_id;          // 802.1Q VLAN of the frames, 0 if untagged
+    uint16_t encap_len;        // Bytes of tag and outer headers in front of a frame
+    uint32_t vni;              // VXLAN network identifier
+    uint64_t tx_offloads;      // TX offloads of the port, set by init_port
     /* TCP/UDP Layer */        
     uint16_t src_port;
     uint16_t dst_port;  
@@ -103,27 +204,72 @@ struct conn_t {
 } __rte_cache_aligned;
 
 struct conf_t {
-    char src_ip_str[LEN_IP_ADDR];
-    char dst_ip_str[LEN_IP_ADDR];  
+    char src_ip_str[MAX_PORT][LEN_IP_ADDR];
+    char dst_ip_str[MAX_PORT][LEN_IP_ADDR];
     char path_to_cpumem[LEN_PATH];
     char rtt_path[LEN_PATH];
+    char file_path[LEN_PATH];  // File to send (client) or to write to (server), -F
+    char fct_cdf[LEN_PATH];    // Flow-size CDF of the FCT test, websearch|datamining|<path>
+    char result_path[LEN_PATH];// Results file, one JSON record appended per run
+    char result_tag[LEN_PATH]; // Label of this run in the results file (--tag)
+    char compare[LEN_PATH];    // "<base tag>,<candidate tag>" to compare (--compare)
 
     bool is_rtt;               // By default, we measure bandwidth rather than rtt
     bool is_server;
     bool is_client;
     bool is_udp;
+    bool is_file;              // Transfer a file (-F)
+    bool is_fct;               // Flow completion time test (--fct)
+    bool is_steal;             // Idle client threads steal tasks from busy ones
+    bool is_verify;            // Stamp (client) or check (server) per-segment CRC32C
+    bool is_rr;                // Closed-loop request/response test (--rr)
+    bool is_pps;               // Small-packet Mpps stress test (--mpps)
+    bool is_pmu;               // Count hardware events per worker thread (--pmu)
 
-    uint16_t port_id;
+    uint32_t burst_us;         // Microburst sampling period, 0 disables it (--microburst)
+    uint16_t ring_rx;          // RX descriptors per queue (--rxd)
+    uint16_t ring_tx;          // TX descriptors per queue (--txd)
+    uint16_t burst_rx;         // RX burst of the threads (--burst)
+    uint16_t burst_tx;         // TX burst of the threads (--burst)
+    uint32_t pool_size;        // Mbufs in the pool of each thread (--pool)
+    bool is_pool_fit;          // No --pool, pool_size follows pool_fit()
+    uint16_t frame_size;       // Largest frame of the threads, tag, outer headers and FCS included
+    uint32_t pool_cache;       // Per-lcore cache of the pools (--mcache)
+    uint16_t mbuf_size;        // Data room of the mbufs, headroom included (--mbuf-size)
+    char sweep[LEN_PATH];      // Parameter grid of --sweep, empty if not sweeping
+    char vdev[MAX_PORT][LEN_PATH]; // EAL device of each port, "<driver><index>[,<args>]" (--vdev)
+    uint16_t num_vdev;         // Number of --vdev, 0 with physical ports
+    bool is_loopback;          // Client and server threads in one process over a port pair
+    bool is_ring_pair;         // The pair of --loopback is made of rte_rings, not an EAL vdev
+    uint8_t  encap;            // Tunnel of the frames, ENCAP_XX (--encap)
+    uint16_t vlan_id;          // 802.1Q VLAN of the frames, 0 if untagged (--vlan)
+    uint16_t encap_len;        // Bytes of tag and outer headers in front of a frame
+    uint32_t vni;              // VXLAN network identifier (--encap vxlan,<vni>)
+
+    uint16_t port_id;          // The first port, the one the main lcore uses
+    uint16_t num_port;         // Number of ports, one per -B address
+    uint16_t ports[MAX_PORT];  // Port identifiers, in -B order
+    uint16_t num_queue[MAX_PORT]; // RX/TX queues of each port, queue 0 included
+    uint16_t thread_lcore[MAX_LCORE]; // lcore (CPU) of each thread, picked by opt_genargv
     uint16_t num_thread;       // Number of DPDK slave threads 
-    uint16_t total_lcore;      // num_thread + 1
+    uint16_t total_lcore;      // num_thread + 1, 2 * num_thread + 1 with --loopback
     uint16_t port_base;        // Base port, thread i's port = port_base + i
     uint16_t win_size;         // Max sliding window size
     uint16_t pkt_size;         // Packet size, Ethernet + IP + TCP/UDP + payload
+    uint8_t  time_unit;        // Unit to report latency, UNIT_NS/US/MS
+    uint8_t  pattern;          // Payload pattern of task buffers, PATTERN_XX
+    uint8_t  steer;            // RX queue steering, STEER_XX, STEER_RSS once RSS is in use
+    uint8_t  rss_key[RSS_KEY_LEN]; // Toeplitz key of the RSS steering
+    uint16_t rr_req;           // Request payload size of the RR test
+    uint16_t rr_resp;          // Response payload size of the RR test
+    uint16_t rr_inflight;      // Outstanding transactions per thread in the RR test
 
-    uint32_t src_ip;           // Local IP    
-    uint32_t dst_ip;           // Server's IP
+    uint32_t src_ip[MAX_PORT]; // Local IP of each port
+    uint32_t dst_ip[MAX_PORT]; // Server's IP reached through each port
     uint32_t num_ping;
-    uint64_t data_size;        // Number of bytes to transmit
+    uint32_t num_flow;         // Number of flows in the FCT test
+    double   load;             // Offered load of the FCT test, fraction of the link speed
+    uint64_t data_size;        // Number of bytes to transmit (per thread, or the file size with -F)
     uint64_t bufsize;          // Size of the sending task
 
     struct timeval all_time;   // Time to transmit for 
@@ -139,6 +285,18 @@ struct conf_t {
  */
 struct conf_t* get_conf(void);
 
+/**
+ * Number of mbufs a thread's pool needs: every RX/TX descriptor, the bursts
+ * being built or parsed and the lcore cache may hold one (one per segment of
+ * chained frames), and so may the ring of the peer over a --loopback ring pair
+ *
+ * @para conf
+ *   Global configuration
+ * @return
+ *   Pool size, 2^n - 1 and at least MIN_MBUF_POOL
+ */
+uint32_t pool_fit(struct conf_t* conf);
+
 /**
  * Generate arguments for eal_init()
  * 
@@ -176,6 +334,14 @@ volatile bool* get_quit(void);
  * Force quit the program
  */
 void set_quit(void);
+/**
+ * Clear the force quit flag before the next trial of --sweep
+ *
+ * @return
+ *   - 0: Success
+ *   - -1: A signal asked the application to exit, the flag stays set
+ */
+int reset_quit(void);
 
 /**
  * Parse arguments
@@ -15,15 +15,232 @@
 #include <rte_ip.h>
 #include <rte_tcp.h>
 #include <rte_udp.h>
+#include <rte_vxlan.h>
+#include <rte_gre.h>
 
 #include "util.h"
 #include "core.h"
 #include "conf.h"
+#include "file.h"
+#include "port.h"
+#include "pmu.h"
+#include "result.h"
 
 #define MAX_TASK 65536
+// Offset of the TCP payload in a frame
+#define PAYLOAD_OFFSET (RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr))
 struct rte_ring* task_todo[MAX_LCORE];
 struct rte_ring* task_done;
 struct rte_mempool* task_pool = NULL;
+struct app_stat_t app_stat[MAX_LCORE];
+struct verify_stat_t verify_stat[MAX_LCORE];
+struct sched_stat_t sched_stat[MAX_LCORE];
+struct rr_stat_t rr_stat[MAX_LCORE];
+struct pps_stat_t pps_stat[MAX_LCORE];
+struct rte_mempool* pps_pool[MAX_LCORE];
+
+static inline uint16_t
+tcp_payload_len(uint16_t pkt_size) {
+    return (uint16_t) (pkt_size - RTE_ETHER_HDR_LEN - sizeof(struct rte_ipv4_hdr) - sizeof(struct rte_tcp_hdr));
+}
+
+/**
+ * xorshift64 with 4 independent lanes. The lanes carry no dependency on
+ * each other, so the inner loop is vectorized by the compiler.
+ */
+#define XORSHIFT_LANES 4
+void
+task_fill(char* addr, uint64_t len, uint64_t seed) {
+    struct conf_t* conf = get_conf();
+    uint64_t* word = (uint64_t*) addr;
+    uint64_t num_word = len / sizeof(uint64_t);
+    uint64_t loop = 0;
+
+    switch (conf->pattern) {
+    case PATTERN_SEQ:
+        for (loop = 0; loop < num_word; loop++)
+            word[loop] = loop * sizeof(uint64_t);
+        break;
+    case PATTERN_RANDOM:
+    case PATTERN_INCOMP: {
+        uint64_t lane[XORSHIFT_LANES];
+        if (conf->pattern == PATTERN_RANDOM)
+            seed = 0;
+        for (int idx = 0; idx < XORSHIFT_LANES; idx++)
+            lane[idx] = 0x9e3779b97f4a7c15ULL * (seed * XORSHIFT_LANES + idx + 1);
+        for (loop = 0; loop + XORSHIFT_LANES <= num_word; loop += XORSHIFT_LANES) {
+            for (int idx = 0; idx < XORSHIFT_LANES; idx++) {
+                lane[idx] ^= lane[idx] << 13;
+                lane[idx] ^= lane[idx] >> 7;
+                lane[idx] ^= lane[idx] << 17;
+                word[loop + idx] = lane[idx];
+            }
+        }
+        for (; loop < num_word; loop++)
+            word[loop] = lane[0] ^ loop;
+        break;
+    }
+    default:
+        memset(addr, 0, len);
+        return;
+    }
+    // Tail bytes that do not fill a whole word
+    memset(addr + num_word * sizeof(uint64_t), 0, len % sizeof(uint64_t));
+}
+
+uint32_t*
+task_crc(char* addr, uint64_t len, int socket_id) {
+    struct conf_t* conf = get_conf();
+    uint16_t seg_len = tcp_payload_len(conf->pkt_size);
+    uint64_t num_seg = (len + seg_len - 1) / seg_len;
+    uint32_t* crc = (uint32_t*) rte_malloc_socket(NULL, num_seg * sizeof(uint32_t), RTE_CACHE_LINE_SIZE, socket_id);
+    if (crc == NULL)
+        return NULL;
+    for (uint64_t loop = 0; loop < num_seg; loop++) {
+        uint64_t off = loop * seg_len;
+        crc[loop] = rte_hash_crc(addr + off, RTE_MIN(seg_len, len - off), CRC_SEED);
+    }
+    return crc;
+}
+
+/**
+ * Charge the cycles since the last call to busy or idle time. Poll-mode
+ * threads are always 100% in /proc, this tells how much headroom is left.
+ */
+static inline void
+account_cycles(struct app_stat_t* st, bool busy) {
+    uint64_t now = rte_rdtsc();
+    if (busy)
+        st->busy_cycles += now - st->last_tsc;
+    else
+        st->idle_cycles += now - st->last_tsc;
+    st->last_tsc = now;
+}
+
+const struct app_stat_t*
+get_app_stat(void) {
+    return app_stat;
+}
+
+void
+print_app(struct conf_t* conf) {
+    LOG_LINE(75, '-', "Thread Statistics");
+    LOG_INFO("Thread   Sent Pkts   Sent GBytes  Acked/Recv Pkts   Retrans   TX Stalls  Empty Polls    Util  Cyc/Pkt\n");
+    uint64_t bad_reqs = 0;
+    for (int loop = 1; loop < conf->total_lcore; loop++) {
+        struct app_stat_t* st = &app_stat[loop];
+        uint64_t cycles = st->busy_cycles + st->idle_cycles;
+        bad_reqs += st->bad_reqs;
+        uint64_t pkts   = st->sent_pkts + st->acked_pkts;
+        LOG_INFO("  %02d   %11lu   %11.3f      %11lu  %8lu  %10lu     %6.2f%%  %5.1f%%  %7.0f\n",
+            loop, st->sent_pkts, st->sent_bytes / 1000000000.0, st->acked_pkts, st->retrans, st->tx_stalls,
+            st->polls > 0 ? st->empty_polls * 100.0 / st->polls : 0,
+            cycles > 0 ? st->busy_cycles * 100.0 / cycles : 0,
+            pkts > 0 ? (double) st->busy_cycles / pkts : 0);
+    }
+    if (bad_reqs > 0)
+        LOG_WARN("%lu requests were malformed or asked for a response larger than an mbuf, dropped\n", bad_reqs);
+    LOG_LINE(75, '-', NULL);
+}
+
+void
+print_sched(struct conf_t* conf) {
+    uint64_t base_tsc = UINT64_MAX, min_tsc = UINT64_MAX, max_tsc = 0;
+    for (int loop = 1; loop <= conf->num_thread; loop++) {
+        if (sched_stat[loop].tasks == 0)
+            continue;
+        base_tsc = RTE_MIN(base_tsc, sched_stat[loop].first_tsc);
+        min_tsc  = RTE_MIN(min_tsc, sched_stat[loop].last_tsc);
+        max_tsc  = RTE_MAX(max_tsc, sched_stat[loop].last_tsc);
+    }
+    if (max_tsc == 0)
+        return;
+
+    LOG_LINE(75, '-', "Completion Time");
+    LOG_INFO("Thread     Tasks    Stolen      GBytes    Done (ms)\n");
+    for (int loop = 1; loop <= conf->num_thread; loop++) {
+        struct sched_stat_t* st = &sched_stat[loop];
+        LOG_INFO("  %02d    %8lu  %8lu  %10.3f  %11.3f\n", loop, st->tasks, st->stolen, st->bytes / 1000000000.0,
+            st->tasks > 0 ? hz_to_ns(st->last_tsc - base_tsc) / 1000000.0 : 0);
+    }
+    LOG_INFO("Skew (slowest - fastest) = %.3f ms, %.2f%% of the run\n",
+        hz_to_ns(max_tsc - min_tsc) / 1000000.0, 100.0 * (max_tsc - min_tsc) / (max_tsc - base_tsc));
+    LOG_LINE(75, '-', NULL);
+}
+
+void
+print_rr(struct conf_t* conf) {
+    static uint64_t hist[HIST_SIZE];
+    uint64_t total = 0, timeouts = 0;
+    double tps = 0;
+    uint8_t unit = conf->time_unit;
+    int prec = (unit == UNIT_NS) ? 0 : 3;
+
+    LOG_LINE(75, '-', "Request/Response");
+    LOG_INFO("Request %hu Bytes, Response %hu Bytes, %hu transaction(s) in flight per thread\n", conf->rr_req, conf->rr_resp, conf->rr_inflight);
+    LOG_INFO("Thread  Transactions   Timeouts      Trans/s\n");
+    memset(hist, 0, sizeof(hist));
+    for (int loop = 1; loop <= conf->num_thread; loop++) {
+        struct rr_stat_t* st = &rr_stat[loop];
+        double thread_tps = (st->cycles > 0) ? st->transactions * 1000000000.0 / hz_to_ns(st->cycles) : 0;
+        LOG_INFO("  %02d    %12lu  %9lu  %11.0f\n", loop, st->transactions, st->timeouts, thread_tps);
+        for (uint32_t idx = 0; idx < HIST_SIZE; idx++)
+            hist[idx] += st->hist[idx];
+        total    += st->transactions;
+        timeouts += st->timeouts;
+        tps      += thread_tps;
+    }
+    LOG_INFO("Total   %12lu  %9lu  %11.0f\n", total, timeouts, tps);
+    result_set(RES_TPS, tps);
+    if (total > 0) {
+        float perc[6] = {50.0, 90.0, 99.0, 99.9, 99.99, 99.999};
+        for (int loop = 0; loop < 6; loop++) {
+            uint64_t value = hist_percentile(hist, total, perc[loop]);
+            LOG_INFO("dperf  ---> percentile %.3f = %.*f %s\n", perc[loop], prec, hz_to_unit(value, unit), time_unit_str(unit));
+            result_set_latency(perc[loop], hz_to_ns(value));
+        }
+        result_set_hist(hist);
+    }
+    LOG_LINE(75, '-', NULL);
+}
+
+void
+print_pps(struct conf_t* conf) {
+    uint32_t link_speed = port_link_speed();
+    // Preamble, SFD and inter-frame gap take 20 bytes on the wire
+    double line_mpps = link_speed / ((conf->pkt_size + 20) * 8.0);
+    double total = 0;
+
+    LOG_LINE(75, '-', "Packet Rate");
+    LOG_INFO("Frame %hu Bytes, line rate %.2f Mpps at %u Mbps\n", conf->pkt_size, line_mpps, link_speed);
+    LOG_INFO("Thread  Queue       Packets    TX full       Mpps\n");
+    for (int loop = 1; loop <= conf->num_thread; loop++) {
+        struct pps_stat_t* st = &pps_stat[loop];
+        double mpps = (st->cycles > 0) ? st->pkts * 1000.0 / hz_to_ns(st->cycles) : 0;
+        LOG_INFO("  %02d    %5hu  %12lu  %9lu  %9.3f\n", loop, conf->conn[loop].queue_id, st->pkts, st->full, mpps);
+        total += mpps;
+    }
+    LOG_INFO("Total                                %9.3f  (%.1f%% of line rate)\n", total, line_mpps > 0 ? total * 100 / line_mpps : 0);
+    LOG_LINE(75, '-', NULL);
+}
+
+void
+print_verify(struct conf_t* conf) {
+    uint64_t segments = 0, corrupted = 0;
+    LOG_LINE(75, '-', "Payload Verification");
+    LOG_INFO("Thread      Segments     Corrupted\n");
+    // The server threads of --loopback follow the client threads
+    for (int loop = conf->is_loopback ? conf->num_thread + 1 : 1; loop < conf->total_lcore; loop++) {
+        LOG_INFO("  %02d    %12lu  %12lu\n", loop, verify_stat[loop].segments, verify_stat[loop].corrupted);
+        segments  += verify_stat[loop].segments;
+        corrupted += verify_stat[loop].corrupted;
+    }
+    if (corrupted > 0)
+        LOG_WARN("Total %12lu  %12lu  "CO_RED"%lu corrupted segment(s)"CO_RESET"\n", segments, corrupted, corrupted);
+    else
+        LOG_INFO("Total %12lu  %12lu\n", segments, corrupted);
+    LOG_LINE(75, '-', NULL);
+}
 
 void
 init_core(struct conf_t* conf) {
@@ -35,6 +252,9 @@ init_core(struct conf_t* conf) {
     }
     task_done = rte_ring_create("TASK_DONE", MAX_TASK, rte_socket_id(), 0);
     task_pool = rte_mempool_create("TASK_POOL", MAX_TASK - 1, sizeof(struct task_t), 0, 0, NULL, NULL, NULL, NULL, rte_socket_id(), 0);
+    // Counters start from zero for every trial of --sweep
+    memset(app_stat, 0, sizeof(app_stat));
+    memset(sched_stat, 0, sizeof(sched_stat));
 }
 
 void
@@ -45,9 +265,12 @@ exit_core(struct conf_t* conf) {
     }
     rte_ring_free(task_done);
     rte_mempool_free(task_pool);
+    for (int loop = 0; loop < conf->total_lcore; loop++) {
+        rte_mempool_free(pps_pool[loop]);
+        pps_pool[loop] = NULL;
+    }
 }
 
-uint64_t th_bytes[32] = {0};
 int
 task_enqueue(struct task_t* todo) {
     struct conf_t* conf = get_conf(); 
@@ -58,17 +281,9 @@ task_enqueue(struct task_t* todo) {
     }
     rte_memcpy(task, todo, sizeof(struct task_t));
 
-    // LB 1
+    // Idle threads steal from busy ones, see task_steal()
     int thread_id = todo->ID % conf->num_thread;
 
-    // LB 2
-    // int thread_id = 0;
-    // for (int loop = 0; loop < CLIENT_THREAD; loop++) {
-    //     if (th_bytes[loop] < th_bytes[thread_id])
-    //         thread_id = loop;
-    // }
-    // th_bytes[thread_id] += task->shm_len;
-
     rte_ring_enqueue(task_todo[thread_id], (void*) task);
     return 0;
 }
@@ -84,32 +299,177 @@ task_enqueue(struct task_t* todo) {
 //     }
 //     return task_id;
 // }
-struct task_t*
-task_dequeue(void) {
+int
+task_dequeue(struct task_t* done) {
     struct task_t* task = NULL;
     int ret = rte_ring_dequeue(task_done, (void**) &task);
-    if (ret == 0) {
-        rte_mempool_put(task_pool, task);
+    if (ret != 0) {
+        return -1;
     }
-    return task;
+    rte_memcpy(done, task, sizeof(struct task_t));
+    rte_mempool_put(task_pool, task);
+    return 0;
 }
 
 static int ping_cmpfunc(list_item_t** a, list_item_t** b) {
     return ((*((struct ping_t**) a))->rtt) - ((*((struct ping_t**) b))->rtt); 
 }
 
-static inline void
+/**
+ * @return
+ *   1 if the TX queue did not take the whole burst at once, 0 otherwise
+ */
+static inline uint32_t
 send_all(uint16_t port_id, uint16_t queue_id, struct rte_mbuf** bufs, uint16_t burst_num) {
     uint16_t nb_tx = rte_eth_tx_burst(port_id, queue_id, bufs, burst_num);
-    uint16_t temp = 0;
-    if (unlikely(nb_tx < burst_num)) {
-        while (nb_tx < burst_num) {
-            temp = rte_eth_tx_burst(port_id, queue_id, &bufs[nb_tx], burst_num - nb_tx);
-            nb_tx += temp;
+    if (likely(nb_tx == burst_num))
+        return 0;
+    while (nb_tx < burst_num)
+        nb_tx += rte_eth_tx_burst(port_id, queue_id, &bufs[nb_tx], burst_num - nb_tx);
+    return 1;
+}
+
+/**
+ * Outer source of a received frame, a server reply goes back through it
+ */
+struct frame_peer_t {
+    struct rte_ether_addr mac;
+    uint32_t addr;
+    uint16_t entropy;           // Outer UDP source port (VXLAN) or GRE key
+};
+
+/**
+ * Put the tunnel headers and the VLAN tag of --encap/--vlan in front of a
+ * built frame. The outer header goes from our address to `dst_mac`/`dst_addr`,
+ * `entropy` is the outer UDP source port (VXLAN) or GRE key the receiver
+ * steers on. Checksums and the tag are left to the port when init_port could
+ * negotiate them, otherwise they are done here.
+ */
+static inline void
+frame_push(struct conn_t* conn, struct rte_mbuf* buf, const struct rte_ether_addr* dst_mac, uint32_t dst_addr, uint16_t entropy) {
+    uint64_t tx_offloads = conn->tx_offloads;
+
+    if (conn->encap != ENCAP_NONE) {
+        uint16_t tnl_len = (conn->encap == ENCAP_VXLAN) ?
+            sizeof(struct rte_udp_hdr) + sizeof(struct rte_vxlan_hdr) : sizeof(struct rte_gre_hdr) + sizeof(rte_be32_t);
+        uint32_t inner_len = buf->pkt_len;
+        struct rte_ether_hdr* h_eth = (struct rte_ether_hdr*) rte_pktmbuf_prepend(buf, RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr) + tnl_len);
+        struct rte_ipv4_hdr*  h_ip4 = (struct rte_ipv4_hdr*) (h_eth + 1);
+        h_eth->s_addr               = conn->src_mac;
+        h_eth->d_addr               = *dst_mac;
+        h_eth->ether_type           = htons(RTE_ETHER_TYPE_IPV4);
+
+        h_ip4->version_ihl          = 0x45;
+        h_ip4->type_of_service      = 0;
+        h_ip4->total_length         = htons(sizeof(struct rte_ipv4_hdr) + tnl_len + inner_len);
+        h_ip4->packet_id            = 0;
+        h_ip4->fragment_offset      = 0;
+        h_ip4->time_to_live         = 0x0f;
+        h_ip4->hdr_checksum         = 0;
+        h_ip4->src_addr             = conn->src_addr;
+        h_ip4->dst_addr             = dst_addr;
+
+        uint64_t tunnel;
+        if (conn->encap == ENCAP_VXLAN) {
+            struct rte_udp_hdr*   h_udp   = (struct rte_udp_hdr*) (h_ip4 + 1);
+            struct rte_vxlan_hdr* h_vxlan = (struct rte_vxlan_hdr*) (h_udp + 1);
+            h_ip4->next_proto_id    = IPPROTO_UDP;
+            h_udp->src_port         = entropy;
+            h_udp->dst_port         = htons(RTE_VXLAN_DEFAULT_PORT);
+            h_udp->dgram_len        = htons(tnl_len + inner_len);
+            h_udp->dgram_cksum      = 0;
+            h_vxlan->vx_flags       = htonl(0x08000000); // I flag, the VNI is valid
+            h_vxlan->vx_vni         = htonl(conn->vni << 8);
+            tunnel = PKT_TX_TUNNEL_VXLAN;
+        } else {
+            struct rte_gre_hdr* h_gre = (struct rte_gre_hdr*) (h_ip4 + 1);
+            h_ip4->next_proto_id    = IPPROTO_GRE;
+            *(rte_be16_t*) h_gre    = htons(0x2000);    // K flag, a key follows
+            h_gre->proto            = htons(RTE_ETHER_TYPE_TEB);
+            *(rte_be32_t*) (h_gre + 1) = htonl(ntohs(entropy));
+            tunnel = PKT_TX_TUNNEL_GRE;
+        }
+
+        if (tx_offloads & DEV_TX_OFFLOAD_OUTER_IPV4_CKSUM) {
+            // The port parses the tunnel, both IPv4 checksums are offloaded
+            buf->outer_l2_len = RTE_ETHER_HDR_LEN;
+            buf->outer_l3_len = sizeof(struct rte_ipv4_hdr);
+            buf->l2_len       = tnl_len + RTE_ETHER_HDR_LEN;
+            buf->l3_len       = sizeof(struct rte_ipv4_hdr);
+            buf->ol_flags    |= tunnel | PKT_TX_OUTER_IPV4 | PKT_TX_OUTER_IP_CKSUM;
+            if (tx_offloads & DEV_TX_OFFLOAD_IPV4_CKSUM)
+                buf->ol_flags|= PKT_TX_IPV4 | PKT_TX_IP_CKSUM;
+        } else if (tx_offloads & DEV_TX_OFFLOAD_IPV4_CKSUM) {
+            // The port only sees the outer header
+            buf->l2_len       = RTE_ETHER_HDR_LEN;
+            buf->l3_len       = sizeof(struct rte_ipv4_hdr);
+            buf->ol_flags    |= PKT_TX_IPV4 | PKT_TX_IP_CKSUM;
+        } else {
+            h_ip4->hdr_checksum = rte_ipv4_cksum(h_ip4);
+        }
+    }
+
+    if (conn->vlan_id > 0) {
+        buf->vlan_tci = conn->vlan_id;
+        if (tx_offloads & DEV_TX_OFFLOAD_VLAN_INSERT) {
+            buf->ol_flags |= PKT_TX_VLAN_PKT;
+        } else {
+            rte_vlan_insert(&buf);
+            if (buf->ol_flags & PKT_TX_TUNNEL_MASK)
+                buf->outer_l2_len += sizeof(struct rte_vlan_hdr);
+            else
+                buf->l2_len += sizeof(struct rte_vlan_hdr);
         }
     }
 }
 
+/**
+ * Remove the VLAN tag (unless the port stripped it) and the tunnel headers
+ * of a received frame, which then starts at the inner Ethernet header
+ *
+ * @para peer
+ *   (OUT) Outer source of the frame, NULL if not needed
+ * @return
+ *   - 0: Success
+ *   - -1: Not a frame of our tunnel
+ */
+static inline int
+frame_pull(struct conn_t* conn, struct rte_mbuf* buf, struct frame_peer_t* peer) {
+    struct rte_ether_hdr* h_eth = rte_pktmbuf_mtod(buf, struct rte_ether_hdr*);
+    if (h_eth->ether_type == htons(RTE_ETHER_TYPE_VLAN)) {
+        rte_vlan_strip(buf);
+        h_eth = rte_pktmbuf_mtod(buf, struct rte_ether_hdr*);
+    }
+    if (conn->encap == ENCAP_NONE)
+        return 0;
+    if (unlikely(h_eth->ether_type != htons(RTE_ETHER_TYPE_IPV4)))
+        return -1;
+
+    struct rte_ipv4_hdr* h_ip4 = (struct rte_ipv4_hdr*) (h_eth + 1);
+    uint16_t hdr_len = RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr);
+    uint16_t entropy;
+    if (conn->encap == ENCAP_VXLAN) {
+        struct rte_udp_hdr* h_udp = (struct rte_udp_hdr*) (h_ip4 + 1);
+        if (unlikely(h_ip4->next_proto_id != IPPROTO_UDP || h_udp->dst_port != htons(RTE_VXLAN_DEFAULT_PORT)))
+            return -1;
+        entropy  = h_udp->src_port;
+        hdr_len += sizeof(struct rte_udp_hdr) + sizeof(struct rte_vxlan_hdr);
+    } else {
+        struct rte_gre_hdr* h_gre = (struct rte_gre_hdr*) (h_ip4 + 1);
+        if (unlikely(h_ip4->next_proto_id != IPPROTO_GRE))
+            return -1;
+        entropy  = htons((uint16_t) ntohl(*(rte_be32_t*) (h_gre + 1)));
+        hdr_len += sizeof(struct rte_gre_hdr) + sizeof(rte_be32_t);
+    }
+    if (peer != NULL) {
+        peer->mac     = h_eth->s_addr;
+        peer->addr    = h_ip4->src_addr;
+        peer->entropy = entropy;
+    }
+    rte_pktmbuf_adj(buf, hdr_len);
+    return 0;
+}
+
 static inline void 
 gen_ping(struct conn_t* conn, struct rte_mbuf *buf, uint16_t payload_len, uint32_t seq) {
     struct rte_ether_hdr *h_eth = NULL;
@@ -142,11 +502,138 @@ gen_ping(struct conn_t* conn, struct rte_mbuf *buf, uint16_t payload_len, uint32
     h_tcp->sent_seq             = htonl(seq);
     h_tcp->data_off             = 0x50;
     h_tcp->rx_win               = 0xffff;
+    // Mbufs are recycled from the RX side, clear what the server looks at
+    h_tcp->tcp_flags            = 0;
+    h_tcp->tcp_urp              = 0;
     // h_tcp->recv_ack             = htonl(seq);
-    // h_tcp->tcp_flags            = RTE_TCP_ACK_FLAG;
 
     // char* payload = rte_pktmbuf_append(buf, payload_len);
     h_ip4->total_length         = htons(buf->data_len - RTE_ETHER_HDR_LEN);
+    if (unlikely(conn->encap_len > 0))
+        frame_push(conn, buf, &conn->dst_mac, conn->dst_addr, conn->src_port);
+}
+
+/**
+ * Build a request of `req_len` payload bytes, marked with URG. The server
+ * replies with `resp_len` payload bytes given in the urgent pointer.
+ */
+static inline void
+gen_rr(struct conn_t* conn, struct rte_mbuf *buf, uint16_t req_len, uint16_t resp_len, uint32_t seq) {
+    struct rte_ether_hdr *h_eth = NULL;
+    struct rte_ipv4_hdr  *h_ip4 = NULL;
+    struct rte_tcp_hdr   *h_tcp = NULL;
+
+    buf->pkt_len                = sizeof(struct rte_ether_hdr);
+    buf->data_len               = sizeof(struct rte_ether_hdr);
+
+    h_eth = rte_pktmbuf_mtod(buf, struct rte_ether_hdr*);
+    h_eth->s_addr               = conn->src_mac;
+    h_eth->d_addr               = conn->dst_mac;
+    h_eth->ether_type           = htons(RTE_ETHER_TYPE_IPV4);
+
+    h_ip4 = (struct rte_ipv4_hdr*) rte_pktmbuf_append(buf, sizeof(struct rte_ipv4_hdr));
+    h_ip4->version_ihl          = 0x45;
+    h_ip4->type_of_service      = 0;
+    h_ip4->packet_id            = 0;
+    h_ip4->fragment_offset      = 0;
+    h_ip4->time_to_live         = 0x0f;
+    h_ip4->next_proto_id        = IPPROTO_TCP;
+    h_ip4->hdr_checksum         = 0;
+    h_ip4->src_addr             = conn->src_addr;
+    h_ip4->dst_addr             = conn->dst_addr;
+
+    h_tcp = (struct rte_tcp_hdr*) rte_pktmbuf_append(buf, sizeof(struct rte_tcp_hdr));
+    h_tcp->src_port             = conn->src_port;
+    h_tcp->dst_port             = conn->dst_port;
+    h_tcp->sent_seq             = htonl(seq);
+    h_tcp->data_off             = 0x50;
+    h_tcp->rx_win               = 0xffff;
+    h_tcp->tcp_flags            = RTE_TCP_URG_FLAG;
+    h_tcp->tcp_urp              = htons(resp_len);
+
+    rte_pktmbuf_append(buf, req_len);
+    h_ip4->total_length         = htons(buf->data_len - RTE_ETHER_HDR_LEN);
+    if (unlikely(conn->encap_len > 0))
+        frame_push(conn, buf, &conn->dst_mac, conn->dst_addr, conn->src_port);
+}
+
+/**
+ * Append `len` bytes of payload to `buf`. Beyond the data room of one mbuf
+ * (jumbo frames over a smaller --mbuf-size) segments are chained from the pool.
+ *
+ * @return
+ *   - `len`: Success
+ *   - 0: The pool ran dry mid-chain, free the frame and build it again later,
+ *     a short segment would shift every following one
+ */
+static inline uint16_t
+append_payload(struct rte_mbuf* buf, const char* src, uint16_t len) {
+    if (likely(len <= rte_pktmbuf_tailroom(buf))) {
+        rte_memcpy(rte_pktmbuf_append(buf, len), src, len);
+        return len;
+    }
+    struct rte_mbuf* last = buf;
+    uint16_t done = 0;
+    for (;;) {
+        uint16_t copy = RTE_MIN((uint16_t) (len - done), rte_pktmbuf_tailroom(last));
+        rte_memcpy(rte_pktmbuf_mtod_offset(last, char*, last->data_len), src + done, copy);
+        last->data_len += copy;
+        buf->pkt_len   += copy;
+        done           += copy;
+        if (done == len)
+            break;
+        struct rte_mbuf* seg = rte_pktmbuf_alloc(buf->pool);
+        if (unlikely(seg == NULL))
+            return 0;
+        last->next = seg;
+        last = seg;
+        buf->nb_segs++;
+    }
+    return done;
+}
+
+/**
+ * CRC32C of `len` payload bytes at offset `off` of a possibly chained frame
+ */
+static inline uint32_t
+payload_crc(struct rte_mbuf* buf, uint32_t off, uint16_t len) {
+    uint32_t crc = CRC_SEED;
+    for (struct rte_mbuf* seg = buf; seg != NULL && len > 0; seg = seg->next) {
+        if (off >= seg->data_len) {
+            off -= seg->data_len;
+            continue;
+        }
+        uint16_t n = RTE_MIN(len, (uint16_t) (seg->data_len - off));
+        crc = rte_hash_crc(rte_pktmbuf_mtod_offset(seg, char*, off), n, crc);
+        len -= n;
+        off  = 0;
+    }
+    return crc;
+}
+
+/**
+ * Write `len` payload bytes at offset `off` of a possibly chained frame to
+ * the file sink of the thread
+ *
+ * @return
+ *   - 0: Success
+ *   - -1: No staging block is free, nothing is written
+ */
+static inline int
+payload_sink(uint16_t thread_id, struct rte_mbuf* buf, uint32_t off, uint16_t len) {
+    for (struct rte_mbuf* seg = buf; seg != NULL && len > 0; seg = seg->next) {
+        if (off >= seg->data_len) {
+            off -= seg->data_len;
+            continue;
+        }
+        uint16_t n = RTE_MIN(len, (uint16_t) (seg->data_len - off));
+        // Only the first piece takes a block, a segment never spans two
+        if (file_sink_put(thread_id, rte_pktmbuf_mtod_offset(seg, const char*, off), n) != 0)
+            return -1;
+        len -= n;
+        off  = 0;
+    }
+    return 0;
 }
 
 static inline uint64_t
@@ -155,8 +642,8 @@ gen_tcp(struct conn_t* conn, struct rte_mbuf *buf, uint64_t sent_bytes, struct t
     struct rte_ipv4_hdr  *h_ip4 = NULL;
     struct rte_tcp_hdr   *h_tcp = NULL;
 
-    uint16_t payload_len = (uint16_t) (conn->pkt_size - RTE_ETHER_HDR_LEN - sizeof(struct rte_ipv4_hdr) - sizeof(struct rte_tcp_hdr));
-    // payload_len = RTE_MIN(payload_len, task->len - sent_bytes);
+    uint16_t seg_len     = tcp_payload_len(conn->pkt_size);
+    uint16_t payload_len = RTE_MIN(seg_len, task->len - sent_bytes);
 
     buf->pkt_len                = sizeof(struct rte_ether_hdr);
     buf->data_len               = sizeof(struct rte_ether_hdr);
@@ -183,10 +670,24 @@ gen_tcp(struct conn_t* conn, struct rte_mbuf *buf, uint64_t sent_bytes, struct t
     h_tcp->sent_seq             = htonl(seq);
     h_tcp->data_off             = 0x50;
     h_tcp->rx_win               = 0xffff;
+    // Mbufs are recycled from the RX side, clear what the server looks at
+    h_tcp->tcp_flags            = 0;
+    h_tcp->tcp_urp              = 0;
 
-    char* payload = rte_pktmbuf_append(buf, payload_len);
-    rte_memcpy(payload, task->addr + sent_bytes, payload_len);
-    h_ip4->total_length         = htons(buf->data_len - RTE_ETHER_HDR_LEN);
+    const char* payload = task->addr + sent_bytes;
+    if (unlikely(append_payload(buf, payload, payload_len) != payload_len))
+        return 0;
+    h_ip4->total_length         = htons(buf->pkt_len - RTE_ETHER_HDR_LEN);
+
+    // The segment's CRC32C travels in the otherwise unused ack field
+    if (task->crc != NULL) {
+        if (likely(payload_len == seg_len))
+            h_tcp->recv_ack     = htonl(task->crc[sent_bytes / seg_len]);
+        else
+            h_tcp->recv_ack     = htonl(rte_hash_crc(payload, payload_len, CRC_SEED));
+    }
+    if (unlikely(conn->encap_len > 0))
+        frame_push(conn, buf, &conn->dst_mac, conn->dst_addr, conn->src_port);
 
     return payload_len;
 }
@@ -198,7 +699,7 @@ gen_udp(struct conn_t* conn, struct rte_mbuf *buf, uint64_t sent_bytes, struct t
     struct rte_udp_hdr   *h_udp = NULL;
 
     uint16_t payload_len = (uint16_t) (conn->pkt_size - RTE_ETHER_HDR_LEN - sizeof(struct rte_ipv4_hdr) - sizeof(struct rte_udp_hdr));
-    // payload_len = RTE_MIN(payload_len, task->len - sent_bytes);
+    payload_len = RTE_MIN(payload_len, task->len - sent_bytes);
 
     buf->pkt_len                = sizeof(struct rte_ether_hdr);
     buf->data_len               = sizeof(struct rte_ether_hdr);
@@ -222,11 +723,12 @@ gen_udp(struct conn_t* conn, struct rte_mbuf *buf, uint64_t sent_bytes, struct t
     h_udp = (struct rte_udp_hdr*) rte_pktmbuf_append(buf, sizeof(struct rte_udp_hdr));
     h_udp->src_port             = conn->src_port;
     h_udp->dst_port             = conn->dst_port;
+    if (unlikely(append_payload(buf, task->addr + sent_bytes, payload_len) != payload_len))
+        return sent_bytes;
     h_udp->dgram_len            = htons(payload_len);
-
-    char* payload = rte_pktmbuf_append(buf, payload_len);
-    rte_memcpy(payload, task->addr + sent_bytes, payload_len);
-    h_ip4->total_length         = htons(buf->data_len - RTE_ETHER_HDR_LEN);
+    h_ip4->total_length         = htons(buf->pkt_len - RTE_ETHER_HDR_LEN);
+    if (unlikely(conn->encap_len > 0))
+        frame_push(conn, buf, &conn->dst_mac, conn->dst_addr, conn->src_port);
 
     return sent_bytes + payload_len;
 }
@@ -242,8 +744,8 @@ do_ping(struct conn_t* conn) {
     struct conf_t* conf = get_conf();
     struct list_t* list = list_alloc();
 
-    struct rte_mbuf *bufs_tx[CLIENT_SIZE_BURST_TX];
-    struct rte_mbuf *bufs_rx[CLIENT_SIZE_BURST_RX];
+    struct rte_mbuf *bufs_tx[MAX_SIZE_BURST];
+    struct rte_mbuf *bufs_rx[MAX_SIZE_BURST];
     // struct rte_ether_hdr *h_eth = NULL;
     struct rte_ipv4_hdr  *h_ip4 = NULL;
     struct rte_tcp_hdr   *h_tcp = NULL;
@@ -269,6 +771,10 @@ do_ping(struct conn_t* conn) {
                 if (nb_rx > 0) {
                     ts_recv = rte_rdtsc();
                     // h_eth = rte_pktmbuf_mtod(bufs_rx[0], struct rte_ether_hdr*);
+                    if (unlikely(conn->encap_len > 0) && frame_pull(conn, bufs_rx[0], NULL) != 0) {
+                        rte_pktmbuf_free_bulk(bufs_rx, nb_rx);
+                        continue;
+                    }
                     h_ip4 = rte_pktmbuf_mtod_offset(bufs_rx[0], struct rte_ipv4_hdr*, RTE_ETHER_HDR_LEN);
                     if (likely(h_ip4->next_proto_id == IPPROTO_TCP)) {
                         h_tcp = rte_pktmbuf_mtod_offset(bufs_rx[0], struct rte_tcp_hdr*, RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr));
@@ -311,24 +817,27 @@ do_ping(struct conn_t* conn) {
         }
         FILE* fp = fopen(conf->rtt_path, "w");
         int counter = 0;
+        uint8_t unit = conf->time_unit;
+        int prec = (unit == UNIT_NS) ? 0 : 3;
         if (fp != NULL) {
             LOG_LINE(75, '-', "Printing statistics");
             LOG_INFO("dperf  [Valid Duration] RunTime=%.2f sec; SentMessages=%u\n", time_diff(begin, end), conf->num_ping);
-            LOG_INFO("dperf  ---> <MIN> observation = %lu us\n", hz_to_us(((struct ping_t*) list_get_first(list))->rtt));
+            LOG_INFO("dperf  ---> <MIN> observation = %.*f %s\n", prec, hz_to_unit(((struct ping_t*) list_get_first(list))->rtt, unit), time_unit_str(unit));
             struct ping_t* iter = NULL;
             int temp_idx = 0;
             YC_LIST_FOREACH(iter, list, struct ping_t) {
                 while (temp_idx < 8 && counter == idxes[temp_idx]) {
-                    LOG_INFO("dperf  ---> percentile %.3f = %lu us\n", perc[temp_idx], hz_to_us(iter->rtt));
+                    LOG_INFO("dperf  ---> percentile %.3f = %.*f %s\n", perc[temp_idx], prec, hz_to_unit(iter->rtt, unit), time_unit_str(unit));
+                    result_set_latency(perc[temp_idx], hz_to_ns(iter->rtt));
                     temp_idx++;
                 }
                 // LOG_INFO("%lu\n", iter->rtt);
                 char buff[64] = {0};
-                sprintf(buff, "loop=%06d    rtt=%lu us\n", ++counter, hz_to_us(iter->rtt));
+                sprintf(buff, "loop=%06d    rtt=%.*f %s\n", ++counter, prec, hz_to_unit(iter->rtt, unit), time_unit_str(unit));
                 fputs(buff, fp);
             }
             fclose(fp);
-            LOG_INFO("dperf  ---> <MAX> observation = %lu us\n", hz_to_us(((struct ping_t*) list_get_last(list))->rtt));
+            LOG_INFO("dperf  ---> <MAX> observation = %.*f %s\n", prec, hz_to_unit(((struct ping_t*) list_get_last(list))->rtt, unit), time_unit_str(unit));
             LOG_INFO("Write rtt results to %s\n", conf->rtt_path);
             LOG_LINE(75, '-', "");
         } else {
@@ -339,28 +848,133 @@ do_ping(struct conn_t* conn) {
     list_free(list);
 }
 
+/**
+ * Closed-loop request/response: keep `rr_inflight` transactions outstanding,
+ * each slot issues its next request as soon as its response arrives.
+ * Slot i carries sequence numbers i, i + MAX_WND, i + 2 * MAX_WND, ...
+ */
+static inline void
+do_rr(struct conn_t* conn) {
+    struct conf_t* conf = get_conf();
+    struct rr_stat_t* st = &rr_stat[conn->ID];
+    struct conn_state_t slot[MAX_WND];
+    struct rte_mbuf *bufs_rx[MAX_SIZE_BURST];
+    struct rte_mbuf *bufs_tx[MAX_WND];
+    struct rte_ipv4_hdr  *h_ip4 = NULL;
+    struct rte_tcp_hdr   *h_tcp = NULL;
+
+    uint16_t nb_rx, nb_tx, loop;
+    uint16_t inflight = conf->rr_inflight;
+    uint32_t seq, idx, counter = 0;
+    uint64_t ts_cur, latency;
+    uint64_t timeout = time_to_hz_ms(RTO);
+    volatile bool* force_quit = get_quit();
+
+    struct app_stat_t* app = &app_stat[conn->ID];
+
+    memset(st, 0, sizeof(struct rr_stat_t));
+    uint64_t ts_begin = rte_rdtsc();
+    app->last_tsc = ts_begin;
+    for (idx = 0; idx < inflight; idx++) {
+        slot[idx].seq = idx;
+        slot[idx].ts  = rte_rdtsc();
+        bufs_tx[idx]  = rte_pktmbuf_alloc(conn->mbuf_pool);
+        gen_rr(conn, bufs_tx[idx], conf->rr_req, conf->rr_resp, idx);
+    }
+    send_all(conn->port_id, conn->queue_id, bufs_tx, inflight);
+
+    for (;;) {
+        nb_tx = 0;
+        nb_rx = rte_eth_rx_burst(conn->port_id, conn->queue_id, bufs_rx, conf->burst_rx);
+        app->polls++;
+        if (nb_rx == 0)
+            app->empty_polls++;
+        if (nb_rx > 0) {
+            ts_cur = rte_rdtsc();
+            for (loop = 0; loop < nb_rx; loop++) {
+                if (unlikely(conn->encap_len > 0) && frame_pull(conn, bufs_rx[loop], NULL) != 0)
+                    continue;
+                h_ip4 = rte_pktmbuf_mtod_offset(bufs_rx[loop], struct rte_ipv4_hdr*, RTE_ETHER_HDR_LEN);
+                if (unlikely(h_ip4->next_proto_id != IPPROTO_TCP))
+                    continue;
+                h_tcp = rte_pktmbuf_mtod_offset(bufs_rx[loop], struct rte_tcp_hdr*, RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr));
+                seq = ntohl(h_tcp->sent_seq);
+                idx = seq & (MAX_WND-1);
+                // Stale responses of resent requests
+                if (unlikely(idx >= inflight || slot[idx].seq != seq))
+                    continue;
+                latency = ts_cur - slot[idx].ts;
+                st->hist[hist_index(latency)]++;
+                st->transactions++;
+                app->acked_pkts++;
+                app->acked_bytes += conf->rr_resp;
+
+                slot[idx].seq += MAX_WND;
+                slot[idx].ts   = ts_cur;
+                bufs_tx[nb_tx] = rte_pktmbuf_alloc(conn->mbuf_pool);
+                gen_rr(conn, bufs_tx[nb_tx++], conf->rr_req, conf->rr_resp, slot[idx].seq);
+            }
+            rte_pktmbuf_free_bulk(bufs_rx, nb_rx);
+        }
+
+        counter++;
+        if (unlikely(counter == 4096)) {
+            counter = 0;
+            if (*force_quit == true)
+                break;
+            // Resend the requests (or responses) that are lost
+            ts_cur = rte_rdtsc();
+            for (idx = 0; idx < inflight && nb_tx < MAX_WND; idx++) {
+                if (ts_cur - slot[idx].ts > timeout) {
+                    st->timeouts++;
+                    app->retrans++;
+                    slot[idx].seq += MAX_WND;
+                    slot[idx].ts   = ts_cur;
+                    bufs_tx[nb_tx] = rte_pktmbuf_alloc(conn->mbuf_pool);
+                    gen_rr(conn, bufs_tx[nb_tx++], conf->rr_req, conf->rr_resp, slot[idx].seq);
+                }
+            }
+        }
+        if (nb_tx > 0) {
+            app->sent_pkts  += nb_tx;
+            app->sent_bytes += nb_tx * conf->rr_req;
+            app->tx_stalls  += send_all(conn->port_id, conn->queue_id, bufs_tx, nb_tx);
+        }
+        account_cycles(app, nb_rx > 0 || nb_tx > 0);
+    }
+    st->cycles = rte_rdtsc() - ts_begin;
+}
+
 static inline void 
 do_tcp(struct conn_t* conn, struct task_t* task, struct conn_client_t* ssc) {
-    struct rte_mbuf *bufs_rx[CLIENT_SIZE_BURST_RX];
-    struct rte_mbuf *bufs_tx[CLIENT_SIZE_BURST_TX];
+    struct rte_mbuf *bufs_rx[MAX_SIZE_BURST];
+    struct rte_mbuf *bufs_tx[MAX_SIZE_BURST];
     // struct rte_ether_hdr *h_eth   = NULL;
     struct rte_ipv4_hdr  *h_ip4   = NULL;
     struct rte_tcp_hdr   *h_tcp   = NULL;
     // struct rte_udp_hdr   *h_udp   = NULL;
 
+    struct conf_t* conf = get_conf();
+    uint16_t burst_rx = conf->burst_rx, burst_tx = conf->burst_tx;
     uint16_t nb_rx, loop, burst_num = 0;
     uint32_t seq, seq_index, seq_next;
     uint64_t ts_cur = 0, acked_bytes = 0, sent_bytes = 0, sent_pkts = 0;
 
     volatile bool* force_quit = get_quit();
     uint32_t counter = 0;
+    struct app_stat_t* st = &app_stat[conn->ID];
 
     // for (;;) {
     while (likely(acked_bytes < task->len)) {
-        nb_rx = rte_eth_rx_burst(conn->port_id, conn->queue_id, bufs_rx, CLIENT_SIZE_BURST_RX);
+        nb_rx = rte_eth_rx_burst(conn->port_id, conn->queue_id, bufs_rx, burst_rx);
+        st->polls++;
+        if (nb_rx == 0)
+            st->empty_polls++;
         if (nb_rx > 0) {
             for (loop = 0; loop < nb_rx; loop++) {
                 // h_eth = rte_pktmbuf_mtod(bufs_rx[loop], struct rte_ether_hdr*);
+                if (unlikely(conn->encap_len > 0) && frame_pull(conn, bufs_rx[loop], NULL) != 0)
+                    continue;
                 h_ip4 = rte_pktmbuf_mtod_offset(bufs_rx[loop], struct rte_ipv4_hdr*, RTE_ETHER_HDR_LEN);
                 if (likely(h_ip4->next_proto_id == IPPROTO_TCP)) {
                     h_tcp = rte_pktmbuf_mtod_offset(bufs_rx[loop], struct rte_tcp_hdr*, RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr));
@@ -369,7 +983,9 @@ do_tcp(struct conn_t* conn, struct task_t* task, struct conn_client_t* ssc) {
                     if (ssc->state[seq_index].seq == seq) {
                         // memset(&(ssc->state[seq_index]), 0, sizeof(struct conn_state_t));
                         acked_bytes += ssc->state[seq_index].bytes;
+                        st->acked_bytes += ssc->state[seq_index].bytes;
                     }
+                    st->acked_pkts++;
                     ssc->state[seq_index].ts = 0;
                     // memset(&(ssc->state[seq_index]), 0, sizeof(struct conn_state_t));
                 }
@@ -389,13 +1005,22 @@ do_tcp(struct conn_t* conn, struct task_t* task, struct conn_client_t* ssc) {
         burst_num = 0;
         ts_cur = rte_rdtsc();
         if (unlikely(((ssc->window + ssc->last_acked) == ssc->last_sent) || (sent_bytes >= task->len))) {
-            while(burst_num < CLIENT_SIZE_BURST_TX) {
+            while(burst_num < burst_tx) {
                 seq_next  = ssc->last_acked + burst_num + 1;
                 seq_index = seq_next & (MAX_WND-1);
                 if (unlikely((ssc->state[seq_index].ts > 0) && (ts_cur > ssc->state[seq_index].ts + 4400000))) {
                     bufs_tx[burst_num] = rte_pktmbuf_alloc(conn->mbuf_pool);
-                    gen_tcp(conn, bufs_tx[burst_num], ssc->state[seq_index].offset, task, seq_next);
+                    if (unlikely(bufs_tx[burst_num] == NULL))
+                        break;
+                    uint64_t bytes = gen_tcp(conn, bufs_tx[burst_num], ssc->state[seq_index].offset, task, seq_next);
+                    // The pool ran dry, retransmit once mbufs are back
+                    if (unlikely(bytes == 0)) {
+                        rte_pktmbuf_free(bufs_tx[burst_num]);
+                        break;
+                    }
+                    st->sent_bytes += bytes;
                     ssc->state[seq_index].ts = ts_cur;
+                    st->retrans++;
                     burst_num++;
                 } else {
                     break;
@@ -403,21 +1028,32 @@ do_tcp(struct conn_t* conn, struct task_t* task, struct conn_client_t* ssc) {
             }
         }
 
-        while (burst_num < CLIENT_SIZE_BURST_TX) {
+        while (burst_num < burst_tx) {
             if (unlikely(((ssc->window + ssc->last_acked) == ssc->last_sent) || (sent_bytes >= task->len)))
                 break;
+            bufs_tx[burst_num]           = rte_pktmbuf_alloc(conn->mbuf_pool);
+            if (unlikely(bufs_tx[burst_num] == NULL))
+                break;
+            uint64_t bytes               = gen_tcp(conn, bufs_tx[burst_num], sent_bytes, task, ssc->last_sent + 1);
+            // The pool ran dry mid-chain, the segment is sent once mbufs are back
+            if (unlikely(bytes == 0)) {
+                rte_pktmbuf_free(bufs_tx[burst_num]);
+                break;
+            }
             sent_pkts++;
             ssc->last_sent++;
             seq_index                    = ssc->last_sent & (MAX_WND-1);
-            bufs_tx[burst_num]           = rte_pktmbuf_alloc(conn->mbuf_pool);
-            ssc->state[seq_index].bytes  = gen_tcp(conn, bufs_tx[burst_num], sent_bytes, task, ssc->last_sent);
+            ssc->state[seq_index].bytes  = bytes;
             ssc->state[seq_index].seq    = ssc->last_sent;
             ssc->state[seq_index].ts     = ts_cur;
             ssc->state[seq_index].offset = sent_bytes;
             sent_bytes                  += ssc->state[seq_index].bytes;
+            st->sent_bytes              += ssc->state[seq_index].bytes;
             burst_num++;
         }
-        send_all(conn->port_id, conn->queue_id, bufs_tx, burst_num);
+        st->sent_pkts += burst_num;
+        st->tx_stalls += send_all(conn->port_id, conn->queue_id, bufs_tx, burst_num);
+        account_cycles(st, nb_rx > 0 || burst_num > 0);
 
         counter++;
         if (unlikely(counter == 4096)) {
@@ -432,20 +1068,148 @@ do_tcp(struct conn_t* conn, struct task_t* task, struct conn_client_t* ssc) {
 static inline void 
 do_udp(struct conn_t* conn, struct task_t* task) {
     // struct rte_mbuf *bufs_rx[CLIENT_SIZE_BURST_RX];
-    struct rte_mbuf *bufs_tx[CLIENT_SIZE_BURST_TX];
+    struct rte_mbuf *bufs_tx[MAX_SIZE_BURST];
 
+    uint16_t burst_tx = get_conf()->burst_tx;
     uint64_t sent_bytes = 0;
     uint16_t loop = 0;
+    struct app_stat_t* st = &app_stat[conn->ID];
 
     while(likely(task->len > sent_bytes)) {
-        for (loop = 0; loop < CLIENT_SIZE_BURST_TX; loop++) {
+        for (loop = 0; loop < burst_tx; loop++) {
             if (unlikely(task->len <= sent_bytes))
                 break;
             bufs_tx[loop] = rte_pktmbuf_alloc(conn->mbuf_pool);
-            sent_bytes = gen_udp(conn, bufs_tx[loop], sent_bytes, task);
+            if (unlikely(bufs_tx[loop] == NULL))
+                break;
+            uint64_t next = gen_udp(conn, bufs_tx[loop], sent_bytes, task);
+            // The pool ran dry mid-chain, the datagram is sent once mbufs are back
+            if (unlikely(next == sent_bytes)) {
+                rte_pktmbuf_free(bufs_tx[loop]);
+                break;
+            }
+            sent_bytes = next;
         }
-        send_all(conn->port_id, conn->queue_id, bufs_tx, loop);
+        st->sent_pkts += loop;
+        st->tx_stalls += send_all(conn->port_id, conn->queue_id, bufs_tx, loop);
+        account_cycles(st, true);
     }
+    st->sent_bytes += sent_bytes;
+}
+
+/**
+ * Write the frame template into every mbuf of the pool once. Frames are only
+ * ever sent and freed back (never received into), so their data survives
+ * recycling and the hot loop only sets lengths.
+ */
+static void
+pps_prebuild(__rte_unused struct rte_mempool* mp, void* opaque, void* obj, __rte_unused unsigned idx) {
+    struct rte_mbuf* buf = (struct rte_mbuf*) obj;
+    struct rte_mbuf* tmpl = (struct rte_mbuf*) opaque;
+    rte_memcpy((char*) buf->buf_addr + RTE_PKTMBUF_HEADROOM, rte_pktmbuf_mtod(tmpl, char*), tmpl->data_len);
+}
+
+/**
+ * Min-size packet engine: pre-built frames, bulk alloc and bursts of
+ * --burst (Defaults: PPS_SIZE_BURST_TX), freed in bulk by the PMD (MBUF_FAST_FREE)
+ */
+static inline void
+do_pps(struct conn_t* conn) {
+    struct conf_t* conf = get_conf();
+    struct pps_stat_t* st = &pps_stat[conn->ID];
+    struct app_stat_t* app = &app_stat[conn->ID];
+    struct rte_mbuf *bufs_tx[MAX_SIZE_BURST];
+    uint16_t burst_tx = conf->burst_tx;
+    uint16_t frame_len = conf->pkt_size - RTE_ETHER_CRC_LEN;
+    uint16_t nb_tx, loop;
+    uint32_t counter = 0;
+
+    // Build the template with the regular UDP path, then stamp it everywhere
+    struct task_t dummy = {0};
+    char zero[MTU] = {0};
+    dummy.addr = zero;
+    dummy.len  = MTU;
+    struct conn_t tmpl_conn = *conn;
+    tmpl_conn.pkt_size = frame_len;
+    struct rte_mbuf* tmpl = rte_pktmbuf_alloc(conn->mbuf_pool);
+    gen_udp(&tmpl_conn, tmpl, 0, &dummy);
+    // With --vlan/--encap the frame grows and carries the offload requests
+    frame_len = tmpl->pkt_len;
+    uint64_t ol_flags   = tmpl->ol_flags;
+    uint64_t tx_offload = tmpl->tx_offload;
+    uint16_t vlan_tci   = tmpl->vlan_tci;
+
+    char pool_name[20];
+    sprintf(pool_name, "PPS_POOL_%u", conn->ID);
+    struct rte_mempool* pool = rte_pktmbuf_pool_create(pool_name, PPS_SIZE_POOL, PPS_SIZE_MCACHE, 0, RTE_PKTMBUF_HEADROOM + RTE_CACHE_LINE_ROUNDUP(frame_len), rte_socket_id());
+    pps_pool[conn->ID] = pool;
+    if (pool == NULL) {
+        LOG_ERRO("Cannot create mbuf pool %s\n", pool_name);
+        rte_pktmbuf_free(tmpl);
+        return;
+    }
+    rte_mempool_obj_iter(pool, pps_prebuild, tmpl);
+    rte_pktmbuf_free(tmpl);
+
+    memset(st, 0, sizeof(struct pps_stat_t));
+    volatile bool* force_quit = get_quit();
+    uint64_t ts_begin = rte_rdtsc();
+    app->last_tsc = ts_begin;
+    for (;;) {
+        nb_tx = 0;
+        if (likely(rte_pktmbuf_alloc_bulk(pool, bufs_tx, burst_tx) == 0)) {
+            for (loop = 0; loop < burst_tx; loop++) {
+                bufs_tx[loop]->data_len = frame_len;
+                bufs_tx[loop]->pkt_len  = frame_len;
+                if (unlikely(ol_flags != 0)) {
+                    bufs_tx[loop]->ol_flags   = ol_flags;
+                    bufs_tx[loop]->tx_offload = tx_offload;
+                    bufs_tx[loop]->vlan_tci   = vlan_tci;
+                }
+            }
+            // Frames the queue does not take are dropped, as a generator would
+            nb_tx = rte_eth_tx_burst(conn->port_id, conn->queue_id, bufs_tx, burst_tx);
+            if (unlikely(nb_tx < burst_tx)) {
+                rte_pktmbuf_free_bulk(&bufs_tx[nb_tx], burst_tx - nb_tx);
+                st->full++;
+                app->tx_stalls++;
+            }
+            st->pkts += nb_tx;
+            app->sent_pkts  += nb_tx;
+            app->sent_bytes += nb_tx * frame_len;
+        }
+        account_cycles(app, nb_tx > 0);
+
+        counter++;
+        if (unlikely(counter == 4096)) {
+            counter = 0;
+            if (*force_quit == true)
+                break;
+        }
+    }
+    st->cycles = rte_rdtsc() - ts_begin;
+}
+
+/**
+ * Steal a queued task from the thread with the longest todo queue. Todo
+ * rings are multi-consumer, so the owner and thieves dequeue concurrently.
+ */
+static inline int
+task_steal(struct conf_t* conf, int thread_id, struct task_t** task) {
+    int victim = -1;
+    unsigned longest = 0;
+    for (int loop = 0; loop < conf->num_thread; loop++) {
+        if (loop == thread_id - 1)
+            continue;
+        unsigned count = rte_ring_count(task_todo[loop]);
+        if (count > longest) {
+            longest = count;
+            victim  = loop;
+        }
+    }
+    if (victim < 0)
+        return -1;
+    return rte_ring_dequeue(task_todo[victim], (void**) task);
 }
 
 int
@@ -455,31 +1219,57 @@ lcore_client(void* arg) {
         LOG_WARN("Port %u is on remote NUMA node to polling thread.\n\tPerformance will not be optimal.\n", conn->port_id);
 
     uint64_t counter = 0;
+    if (get_conf()->is_pmu == true)
+        pmu_open(conn->ID);
     if (conn->is_rtt == true) {
         do_ping(conn);
         return 0;
     } 
+    if (get_conf()->is_rr == true) {
+        do_rr(conn);
+        return 0;
+    }
+    if (get_conf()->is_pps == true) {
+        do_pps(conn);
+        return 0;
+    }
 
     int thread_id = conn->ID;
     int ret = 0;
     struct task_t* task = NULL;
     struct rte_ring* task_queue = task_todo[thread_id-1];
     struct conf_t* conf = get_conf();
+    struct sched_stat_t* st = &sched_stat[thread_id];
+    struct app_stat_t* app = &app_stat[thread_id];
     struct conn_client_t ssc = {0};
     ssc.last_sent = 0xffffffff;
     ssc.last_acked= 0xffffffff;
     ssc.window = conf->win_size;
 
     volatile bool* force_quit = get_quit();
+    app->last_tsc = rte_rdtsc();
     for (;;) {
         ret = rte_ring_dequeue(task_queue, (void**) &task);
+        if (ret != 0 && conf->is_steal == true) {
+            ret = task_steal(conf, thread_id, &task);
+            if (ret == 0)
+                st->stolen++;
+        }
         if (ret == 0) {
+            if (unlikely(st->first_tsc == 0))
+                st->first_tsc = rte_rdtsc();
             if (conf->is_udp == false) {
                 do_tcp(conn, task, &ssc);
             } else {
                 do_udp(conn, task);
             }
+            st->tasks++;
+            st->bytes += task->len;
+            st->last_tsc = rte_rdtsc();
+            task->ts_done = st->last_tsc;
             rte_ring_enqueue(task_done, (void*) task);
+        } else {
+            account_cycles(app, false);
         }
         
         if (unlikely((counter & 0x4000) != 0)) {
@@ -499,55 +1289,124 @@ lcore_server(void* arg) {
     if (rte_eth_dev_socket_id(conn->port_id) > 0 && rte_eth_dev_socket_id(conn->port_id) != (int) rte_socket_id())
         LOG_WARN("Port %u is on remote NUMA node to polling thread.\n\tPerformance will not be optimal.\n", conn->port_id);
 
-    struct rte_mbuf      *bufs_rx[SERVER_SIZE_BURST_RX];
-    struct rte_mbuf      *bufs_tx[SERVER_SIZE_BURST_TX];
+    struct rte_mbuf      *bufs_rx[MAX_SIZE_BURST];
+    struct rte_mbuf      *bufs_tx[MAX_SIZE_BURST];
     struct rte_ether_hdr *h_eth   = NULL;
     struct rte_ipv4_hdr  *h_ip4   = NULL;
     struct rte_tcp_hdr   *h_tcp   = NULL;
     // struct rte_udp_hdr   *h_udp   = NULL;
 
-    uint16_t rx_burst = SERVER_SIZE_BURST_RX;
-    __attribute__((unused)) uint16_t tx_burst = SERVER_SIZE_BURST_TX;
+    uint16_t rx_burst = get_conf()->burst_rx;
+    __attribute__((unused)) uint16_t tx_burst = get_conf()->burst_tx;
 
     if (conn->is_rtt == true) {
         rx_burst = 8;
         tx_burst = 8;
     }
 
+    struct conf_t* conf = get_conf();
+    if (conf->is_pmu == true)
+        pmu_open(conn->ID);
+    struct verify_stat_t* vstat = &verify_stat[conn->ID];
+    struct app_stat_t* st = &app_stat[conn->ID];
+    bool is_verify = conf->is_verify;
+    bool is_file   = conf->is_file;
+    uint16_t payload_len = 0, resp_len = 0, port = 0, ip_len = 0;
+    uint32_t seq, next_seq = 0;
+    struct frame_peer_t peer = {0};
+
     uint16_t nb_rx, nb_tx, loop;
     uint32_t counter = 0;
+    st->last_tsc = rte_rdtsc();
     for (;;) {
         nb_rx = rte_eth_rx_burst(conn->port_id, conn->queue_id, bufs_rx, rx_burst);
+        st->polls++;
+        if (nb_rx == 0)
+            st->empty_polls++;
         if (nb_rx > 0) {
             nb_tx = 0;
+            st->acked_pkts += nb_rx;
             for (loop = 0; loop < nb_rx; loop++) {
+                // Replies go back through the tunnel endpoint of the request
+                if (unlikely(conn->encap_len > 0) && frame_pull(conn, bufs_rx[loop], &peer) != 0)
+                    continue;
                 h_eth = rte_pktmbuf_mtod(bufs_rx[loop], struct rte_ether_hdr*);
                 h_ip4 = rte_pktmbuf_mtod_offset(bufs_rx[loop], struct rte_ipv4_hdr*, RTE_ETHER_HDR_LEN);
                 if (likely(h_ip4->next_proto_id == IPPROTO_TCP)) {
                     h_tcp = rte_pktmbuf_mtod_offset(bufs_rx[loop], struct rte_tcp_hdr*, RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr));
 
+                    // Short or truncated frames would wrap the payload length
+                    ip_len = ntohs(h_ip4->total_length);
+                    if (unlikely(ip_len < sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr) ||
+                                 RTE_ETHER_HDR_LEN + ip_len > rte_pktmbuf_pkt_len(bufs_rx[loop]))) {
+                        st->bad_reqs++;
+                        continue;
+                    }
+                    payload_len = ip_len - sizeof(struct rte_ipv4_hdr) - sizeof(struct rte_tcp_hdr);
+                    // Requests of the request/response test are marked with
+                    // URG and carry the response length
+                    resp_len = 0;
+                    if (h_tcp->tcp_flags & RTE_TCP_URG_FLAG) {
+                        resp_len = RTE_MIN(ntohs(h_tcp->tcp_urp), RR_MAX_LEN);
+                        payload_len = 0;
+                    }
+                    st->acked_bytes += payload_len;
+                    if (is_verify == true && payload_len > 0) {
+                        vstat->segments++;
+                        if (unlikely(payload_crc(bufs_rx[loop], PAYLOAD_OFFSET, payload_len) != ntohl(h_tcp->recv_ack)))
+                            vstat->corrupted++;
+                    }
+                    // Only in-order segments are written and acked, the client
+                    // retransmits the others once they time out
+                    if (is_file == true && payload_len > 0) {
+                        seq = ntohl(h_tcp->sent_seq);
+                        if (seq == next_seq) {
+                            if (payload_sink(conn->ID, bufs_rx[loop], PAYLOAD_OFFSET, payload_len) != 0)
+                                continue;
+                            next_seq++;
+                        } else if ((int32_t) (seq - next_seq) > 0) {
+                            continue;
+                        }
+                    }
+
                     bufs_tx[nb_tx] = rte_pktmbuf_alloc(conn->mbuf_pool);
+                    if (unlikely(bufs_tx[nb_tx] == NULL))
+                        continue;
+                    // The response must fit the mbuf, e.g. with a small --mbuf-size
+                    if (unlikely(RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr) + resp_len > rte_pktmbuf_tailroom(bufs_tx[nb_tx]))) {
+                        rte_pktmbuf_free(bufs_tx[nb_tx]);
+                        st->bad_reqs++;
+                        continue;
+                    }
 
                     h_eth->d_addr   = h_eth->s_addr;
                     h_eth->s_addr   = conn->src_mac;
                     h_ip4->dst_addr = h_ip4->src_addr;
                     h_ip4->src_addr = conn->src_addr;
+                    // Echo the port pair, with RSS steering the segment may
+                    // be for another thread's port
+                    port = h_tcp->dst_port;
                     h_tcp->dst_port = h_tcp->src_port;
-                    h_tcp->src_port = conn->src_port;
+                    h_tcp->src_port = port;
                     h_tcp->tcp_flags= RTE_TCP_ACK_FLAG;
 
-                    h_ip4->total_length = htons(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr));
+                    h_ip4->total_length = htons(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr) + resp_len);
 
                     rte_memcpy(rte_pktmbuf_mtod(bufs_tx[nb_tx], struct rte_ether_hdr *), h_eth, RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr));
-                    bufs_tx[nb_tx]->data_len = RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr);
-                    bufs_tx[nb_tx]->pkt_len  = RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr);
+                    bufs_tx[nb_tx]->data_len = RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr) + resp_len;
+                    bufs_tx[nb_tx]->pkt_len  = RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr) + resp_len;
+                    if (unlikely(conn->encap_len > 0))
+                        frame_push(conn, bufs_tx[nb_tx], &peer.mac, peer.addr, peer.entropy);
 
+                    st->sent_bytes += resp_len;
                     nb_tx++;
                 }
             }
-            send_all(conn->port_id, conn->queue_id, bufs_tx, nb_tx);
+            st->sent_pkts  += nb_tx;
+            st->tx_stalls  += send_all(conn->port_id, conn->queue_id, bufs_tx, nb_tx);
             rte_pktmbuf_free_bulk(bufs_rx, nb_rx);
         }
+        account_cycles(st, nb_rx > 0);
         counter++;
         if (unlikely(counter == 4096)) {
             counter = 0;
@@ -558,5 +1417,7 @@ lcore_server(void* arg) {
         }
     }
 
+    if (is_file == true)
+        file_sink_flush(conn->ID);
     return 0;
 }
\ No newline at end of file
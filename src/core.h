@@ -3,12 +3,24 @@
 
 #include "conf.h"
 #include "list.h"
+#include "util.h"
 
 struct task_t {
     list_item_t super;
     uint64_t ID;
     char* addr;
     uint64_t len;
+    uint32_t* crc;              // CRC32C of each TCP segment in addr, NULL if not verified
+    uint64_t ts_enqueue;        // The task (flow) arrives, --fct only
+    uint64_t ts_done;           // The task is completed
+} __rte_cache_aligned;
+
+/**
+ * Payload verification counters of a server thread
+ */
+struct verify_stat_t {
+    uint64_t segments;          // Number of segments checked
+    uint64_t corrupted;         // Number of segments whose CRC32C mismatches
 } __rte_cache_aligned;
 
 struct ping_t {
@@ -80,8 +92,150 @@ int lcore_client(void* arg);
  */
 int lcore_server(void* arg);
 
+/**
+ * Application counters of a thread. Each thread only writes its own slot, plain
+ * stores into its own cache line, the main lcore reads all slots every interval.
+ */
+struct app_stat_t {
+    uint64_t sent_pkts;         // Number of packets sent, retransmissions included
+    uint64_t sent_bytes;        // Number of payload bytes sent
+    uint64_t acked_pkts;        // Number of ACKs received (client) or packets received (server)
+    uint64_t acked_bytes;       // Number of payload bytes acked (client) or received (server)
+    uint64_t retrans;           // Number of retransmitted packets
+    uint64_t empty_polls;       // Number of RX polls returning no packet
+    uint64_t polls;             // Number of RX polls
+    uint64_t tx_stalls;         // Number of TX bursts the queue did not fully take
+    uint64_t busy_cycles;       // Cycles of loop iterations that received or sent something
+    uint64_t idle_cycles;       // Cycles of empty polls and of waiting for a task
+    uint64_t bad_reqs;          // Number of requests dropped, malformed or their response does not fit an mbuf
+    uint64_t last_tsc;          // End of the last accounted iteration
+} __rte_cache_aligned;
+
+/**
+ * Get the application counters of all threads, indexed by thread ID
+ *
+ * @return
+ *   Array of MAX_LCORE slots
+ */
+const struct app_stat_t* get_app_stat(void);
+
+/**
+ * Print per-thread application counters
+ *
+ * @para conf
+ *   Global configuration
+ */
+void print_app(struct conf_t* conf);
+
+/**
+ * Scheduling counters of a client thread
+ */
+struct sched_stat_t {
+    uint64_t tasks;             // Number of tasks completed
+    uint64_t stolen;            // Number of tasks stolen from other threads
+    uint64_t bytes;             // Number of bytes completed
+    uint64_t first_tsc;         // The first task is dequeued
+    uint64_t last_tsc;          // The last task is completed
+} __rte_cache_aligned;
+
+/**
+ * Request/response counters of a client thread
+ */
+struct rr_stat_t {
+    uint64_t transactions;      // Number of completed transactions
+    uint64_t timeouts;          // Number of requests resent after RTO
+    uint64_t cycles;            // Duration of the test on this thread
+    uint64_t hist[HIST_SIZE];   // Latency histogram (cycles)
+} __rte_cache_aligned;
+
+/**
+ * Small-packet counters of a client thread (one TX queue each)
+ */
+struct pps_stat_t {
+    uint64_t pkts;              // Number of frames handed to the NIC
+    uint64_t full;              // Number of TX bursts the queue did not fully take
+    uint64_t cycles;            // Duration of the test on this thread
+} __rte_cache_aligned;
+
+/**
+ * Fill a task buffer with the configured payload pattern
+ *
+ * @para addr
+ *   Task buffer
+ * @para len
+ *   Length of the buffer
+ * @para seed
+ *   Seed of the xorshift stream, makes PATTERN_INCOMP unique per buffer
+ */
+void task_fill(char* addr, uint64_t len, uint64_t seed);
+
+/**
+ * Precompute the CRC32C of every TCP segment of a task buffer, so that the
+ * sender stamps segments with a table lookup.
+ *
+ * @para addr
+ *   Task buffer, filled already
+ * @para len
+ *   Length of the buffer
+ * @para socket_id
+ *   NUMA node to allocate the table on
+ * @return
+ *   The CRC table, free with rte_free()
+ */
+uint32_t* task_crc(char* addr, uint64_t len, int socket_id);
+
+/**
+ * Print per-thread completion time and its skew across client threads
+ *
+ * @para conf
+ *   Global configuration
+ */
+void print_sched(struct conf_t* conf);
+
+/**
+ * Print transactions/s and latency percentiles of the request/response test
+ *
+ * @para conf
+ *   Global configuration
+ */
+void print_rr(struct conf_t* conf);
+
+/**
+ * Print Mpps per thread/queue and in total against the line rate of the port
+ *
+ * @para conf
+ *   Global configuration
+ */
+void print_pps(struct conf_t* conf);
+
+/**
+ * Print payload verification counters of the server threads
+ *
+ * @para conf
+ *   Global configuration
+ */
+void print_verify(struct conf_t* conf);
+
+/**
+ * Dispatch a task to the todo queue of a slave core
+ *
+ * @para todo
+ *   Task to be sent, copied into the task pool
+ * @return
+ *   - 0: Success
+ *   - -1: The task pool is exhausted
+ */
 int task_enqueue(struct task_t* todo);
 // uint64_t task_dequeue(void);
-struct task_t* task_dequeue(void);
+/**
+ * Fetch a completed task from the done queue
+ *
+ * @para done
+ *   (OUT) Completed task, its buffer can be reused for the next task
+ * @return
+ *   - 0: Success
+ *   - -1: No task is completed
+ */
+int task_dequeue(struct task_t* done);
 
 #endif
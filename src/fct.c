@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include <rte_random.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+
+#include "util.h"
+#include "conf.h"
+#include "core.h"
+#include "port.h"
+#include "fct.h"
+
+/**
+ * Web search workload (DCTCP, SIGCOMM'10)
+ */
+static const struct cdf_point_t cdf_websearch[] = {
+    {0, 0}, {10000, 0.15}, {20000, 0.20}, {30000, 0.30}, {50000, 0.40}, {80000, 0.53},
+    {200000, 0.60}, {1000000, 0.70}, {2000000, 0.80}, {5000000, 0.90}, {10000000, 0.97},
+    {30000000, 1.0}
+};
+
+/**
+ * Data mining workload (VL2, SIGCOMM'09)
+ */
+static const struct cdf_point_t cdf_datamining[] = {
+    {0, 0}, {180, 0.1}, {216, 0.2}, {560, 0.3}, {900, 0.4}, {1100, 0.5}, {1870, 0.6},
+    {3160, 0.7}, {10000, 0.8}, {400000, 0.9}, {3160000, 0.95}, {100000000, 0.98},
+    {1000000000, 1.0}
+};
+
+/**
+ * Upper bounds (bytes) of the flow-size buckets
+ */
+static const uint64_t bucket_bound[NUM_FCT_BUCKET] = {100000, 1000000, 10000000, UINT64_MAX};
+static const char* bucket_name[NUM_FCT_BUCKET] = {"<100KB", "100KB-1MB", "1MB-10MB", ">10MB"};
+
+struct cdf_point_t cdf[MAX_CDF_POINTS];
+int num_cdf = 0;
+
+int
+fct_load_cdf(const char* name) {
+    if (strcmp(name, "websearch") == 0) {
+        num_cdf = RTE_DIM(cdf_websearch);
+        memcpy(cdf, cdf_websearch, sizeof(cdf_websearch));
+        return 0;
+    } else if (strcmp(name, "datamining") == 0) {
+        num_cdf = RTE_DIM(cdf_datamining);
+        memcpy(cdf, cdf_datamining, sizeof(cdf_datamining));
+        return 0;
+    }
+
+    FILE* fp = fopen(name, "r");
+    if (fp == NULL) {
+        LOG_ERRO("Cannot open CDF file %s\n", name);
+        return -1;
+    }
+    num_cdf = 0;
+    char buff[128];
+    while (fgets(buff, sizeof(buff), fp) != NULL && num_cdf < MAX_CDF_POINTS) {
+        if (buff[0] == '#')
+            continue;
+        if (sscanf(buff, "%lf %lf", &cdf[num_cdf].size, &cdf[num_cdf].prob) == 2)
+            num_cdf++;
+    }
+    fclose(fp);
+
+    if (num_cdf < 2) {
+        LOG_ERRO("CDF file %s needs at least 2 \"<size> <probability>\" lines\n", name);
+        return -1;
+    }
+    // Accept percentages as well
+    if (cdf[num_cdf-1].prob > 1.0) {
+        for (int loop = 0; loop < num_cdf; loop++)
+            cdf[loop].prob /= 100.0;
+    }
+    for (int loop = 1; loop < num_cdf; loop++) {
+        if (cdf[loop].prob < cdf[loop-1].prob || cdf[loop].size < cdf[loop-1].size) {
+            LOG_ERRO("CDF file %s is not monotonic at line %d\n", name, loop + 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static inline double
+rand_uniform(void) {
+    return (rte_rand() >> 11) * 0x1.0p-53;
+}
+
+/**
+ * Inverse transform sampling, linear between two points of the CDF
+ */
+static uint64_t
+cdf_sample(void) {
+    double u = rand_uniform() * cdf[num_cdf-1].prob;
+    for (int loop = 1; loop < num_cdf; loop++) {
+        if (u <= cdf[loop].prob) {
+            double span = cdf[loop].prob - cdf[loop-1].prob;
+            double frac = (span > 0) ? (u - cdf[loop-1].prob) / span : 1.0;
+            double size = cdf[loop-1].size + frac * (cdf[loop].size - cdf[loop-1].size);
+            return RTE_MAX((uint64_t) size, 1);
+        }
+    }
+    return RTE_MAX((uint64_t) cdf[num_cdf-1].size, 1);
+}
+
+static double
+cdf_mean(void) {
+    double mean = 0;
+    for (int loop = 1; loop < num_cdf; loop++)
+        mean += (cdf[loop].prob - cdf[loop-1].prob) * (cdf[loop].size + cdf[loop-1].size) / 2;
+    return mean;
+}
+
+static int
+u64_cmpfunc(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void
+print_fct(struct flow_t* flows, uint32_t num_sent) {
+    struct conf_t* conf = get_conf();
+    uint8_t unit = conf->time_unit;
+    int prec = (unit == UNIT_NS) ? 0 : 3;
+    uint64_t* fct = (uint64_t*) malloc((num_sent + 1) * sizeof(uint64_t));
+
+    LOG_LINE(90, '-', "Flow Completion Time");
+    LOG_INFO("Bucket         Flows          Mean           P50           P99         P99.9  (%s)\n", time_unit_str(unit));
+    for (int bucket = 0; bucket <= NUM_FCT_BUCKET; bucket++) {
+        uint32_t num = 0;
+        double sum = 0;
+        uint64_t lower = (bucket > 0 && bucket < NUM_FCT_BUCKET) ? bucket_bound[bucket-1] : 0;
+        for (uint32_t loop = 0; loop < num_sent; loop++) {
+            // Not completed before force quit
+            if (flows[loop].fct == 0)
+                continue;
+            // The last round covers all flows
+            if (bucket == NUM_FCT_BUCKET || (flows[loop].size > lower && flows[loop].size <= bucket_bound[bucket])) {
+                fct[num++] = flows[loop].fct;
+                sum += flows[loop].fct;
+            }
+        }
+        if (num == 0)
+            continue;
+        qsort(fct, num, sizeof(uint64_t), u64_cmpfunc);
+        LOG_INFO("%-10s  %8u  %12.*f  %12.*f  %12.*f  %12.*f\n",
+            bucket == NUM_FCT_BUCKET ? "All" : bucket_name[bucket],
+            num,
+            prec, hz_to_unit(sum / num, unit),
+            prec, hz_to_unit(fct[(uint32_t) (num * 0.5)], unit),
+            prec, hz_to_unit(fct[(uint32_t) (num * 0.99)], unit),
+            prec, hz_to_unit(fct[(uint32_t) (num * 0.999)], unit)
+        );
+    }
+    LOG_LINE(90, '-', NULL);
+    free(fct);
+}
+
+void
+fct_run(void) {
+    struct conf_t* conf = get_conf();
+
+    uint32_t link_speed = port_link_speed();
+    uint64_t link_bps = (link_speed > 0) ? link_speed * 1000000ULL : 100000000000ULL;
+
+    // Mean gap between arrivals so that the offered load is `load` of the link
+    double mean_size = cdf_mean();
+    double mean_gap  = mean_size * 8 / (conf->load * link_bps) * rte_get_timer_hz();
+    uint64_t max_size = (uint64_t) cdf[num_cdf-1].size;
+    LOG_INFO("FCT test: %u flows, mean size %.0f Bytes, load %.2f of %lu Gbps, mean inter-arrival %.2f us\n",
+        conf->num_flow, mean_size, conf->load, link_bps / 1000000000, hz_to_ns(mean_gap) / 1000.0);
+
+    // Payload is irrelevant here. Reads of an untouched anonymous mapping hit
+    // the shared zero page, so even 1GB flows cost no memory.
+    char* payload = mmap(NULL, max_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (payload == MAP_FAILED) {
+        LOG_ERRO("Cannot map %lu bytes for flow payload\n", max_size);
+        return;
+    }
+    struct flow_t* flows = (struct flow_t*) calloc(conf->num_flow, sizeof(struct flow_t));
+
+    volatile bool* force_quit = get_quit();
+    uint32_t num_sent = 0, num_done = 0;
+    uint64_t next_tsc = rte_rdtsc();
+    struct task_t todo = {0};
+    struct task_t done;
+    while (num_done < conf->num_flow && !(*force_quit)) {
+        uint64_t cur_tsc = rte_rdtsc();
+        if (num_sent < conf->num_flow && cur_tsc >= next_tsc) {
+            if (todo.len == 0) {
+                todo.ID   = num_sent;
+                todo.addr = payload;
+                todo.len  = cdf_sample();
+                todo.ts_enqueue = next_tsc;
+            }
+            // The arrival time is kept if the task pool is exhausted, so the
+            // wait counts into the FCT
+            if (task_enqueue(&todo) == 0) {
+                flows[num_sent++].size = todo.len;
+                todo.len = 0;
+                next_tsc += (uint64_t) (-log(1.0 - rand_uniform()) * mean_gap);
+            }
+        }
+        if (task_dequeue(&done) == 0) {
+            flows[done.ID].fct = done.ts_done - done.ts_enqueue;
+            num_done++;
+        }
+    }
+
+    if (num_done < num_sent)
+        LOG_WARN("%u of %u flows did not complete\n", num_sent - num_done, num_sent);
+    print_fct(flows, num_sent);
+    free(flows);
+    munmap(payload, max_size);
+}
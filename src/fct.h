@@ -0,0 +1,53 @@
+#ifndef _FCT_H_
+#define _FCT_H_
+
+#include <stdint.h>
+
+#include "conf.h"
+
+/**
+ * Max number of points of a flow-size CDF
+ */
+#define MAX_CDF_POINTS        128
+/**
+ * Number of flow-size buckets to report FCT for
+ */
+#define NUM_FCT_BUCKET        4
+
+/**
+ * A point of a flow-size CDF
+ */
+struct cdf_point_t {
+    double size;                // Flow size (bytes)
+    double prob;                // P(X <= size), in [0, 1]
+};
+
+/**
+ * A completed flow
+ */
+struct flow_t {
+    uint64_t size;              // Flow size (bytes)
+    uint64_t fct;               // Flow completion time (cycles), from arrival to the last ack
+};
+
+/**
+ * Load the flow-size CDF given by --fct, either a built-in one (websearch,
+ * datamining) or a file of "<size in bytes> <cumulative probability>" lines.
+ *
+ * @para name
+ *   websearch, datamining or a path
+ * @return
+ *   - 0: Success
+ *   - -1: Otherwise
+ */
+int fct_load_cdf(const char* name);
+
+/**
+ * Generate `num_flow` flows with sizes drawn from the CDF and Poisson arrivals
+ * at the target load, dispatch each as a task as it arrives, collect the
+ * completions from task_done and report FCT percentiles per flow-size bucket.
+ * Runs on the master core and returns once all flows complete or on force quit.
+ */
+void fct_run(void);
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE         // O_DIRECT
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <rte_ring.h>
+#include <rte_malloc.h>
+#include <rte_cycles.h>
+
+#include "util.h"
+#include "conf.h"
+#include "file.h"
+
+/**
+ * Source file (client)
+ */
+struct file_src_t {
+    int fd;
+    char* addr;
+    uint64_t size;
+    uint64_t disk_cycles;       // Cycles spent faulting in chunks
+    uint64_t read_bytes;
+    uint64_t first_tsc;         // The first chunk is handed out
+};
+
+/**
+ * Per-thread staging state (server)
+ */
+struct sink_t {
+    struct rte_ring* free;      // Free blocks, SP (writer) / SC (lcore)
+    struct wblock_t* cur;       // Block being filled
+    uint64_t pos;               // Bytes received in order
+    uint64_t first_tsc;
+    uint64_t last_tsc;
+} __rte_cache_aligned;
+
+/**
+ * Sink file (server)
+ */
+struct file_sink_t {
+    int fd;                     // O_DIRECT, for whole aligned blocks
+    int fd_buf;                 // Buffered, for the unaligned tail blocks
+    bool is_direct;
+    pthread_t writer;
+    volatile bool stop;
+    struct rte_ring* todo;      // Filled blocks, MP (lcores) / SC (writer)
+    uint64_t disk_cycles;       // Cycles spent in pwrite
+    uint64_t written_bytes;
+    uint64_t end;               // File size
+    struct sink_t sink[MAX_LCORE];
+};
+
+struct file_src_t  fsrc  = { .fd = -1 };
+struct file_sink_t fsink = { .fd = -1, .fd_buf = -1 };
+
+int
+file_open_src(const char* path) {
+    struct stat st;
+    fsrc.fd = open(path, O_RDONLY);
+    if (fsrc.fd < 0 || fstat(fsrc.fd, &st) != 0 || st.st_size == 0) {
+        LOG_ERRO("Cannot open %s or it is empty\n", path);
+        return -1;
+    }
+    fsrc.size = st.st_size;
+    fsrc.addr = mmap(NULL, fsrc.size, PROT_READ, MAP_SHARED, fsrc.fd, 0);
+    if (fsrc.addr == MAP_FAILED) {
+        LOG_ERRO("Cannot mmap %s: %s\n", path, strerror(errno));
+        close(fsrc.fd);
+        return -1;
+    }
+    madvise(fsrc.addr, fsrc.size, MADV_SEQUENTIAL);
+    LOG_INFO("Mapped %s (%.2f MB)\n", path, fsrc.size / 1000000.0);
+    return 0;
+}
+
+uint64_t
+file_src_size(void) {
+    return fsrc.size;
+}
+
+char*
+file_src_chunk(uint64_t chunk_id, uint64_t* len) {
+    struct conf_t* conf = get_conf();
+    uint64_t off = chunk_id * conf->bufsize;
+    if (off >= fsrc.size)
+        return NULL;
+    *len = RTE_MIN(conf->bufsize, fsrc.size - off);
+
+    uint64_t ts = rte_rdtsc();
+    if (fsrc.first_tsc == 0)
+        fsrc.first_tsc = ts;
+    volatile char* addr = fsrc.addr + off;
+    char sum = 0;
+    for (uint64_t loop = 0; loop < *len; loop += FILE_ALIGN)
+        sum += addr[loop];
+    (void) sum;
+    fsrc.disk_cycles += rte_rdtsc() - ts;
+    fsrc.read_bytes  += *len;
+
+    return fsrc.addr + off;
+}
+
+void
+file_close_src(uint64_t acked_bytes) {
+    if (fsrc.addr == NULL)
+        return;
+    uint64_t net_cycles = rte_rdtsc() - fsrc.first_tsc;
+    double disk_s = hz_to_ns(fsrc.disk_cycles) / 1000000000.0;
+    double net_s  = hz_to_ns(net_cycles) / 1000000000.0;
+    LOG_LINE(75, '-', "File Statistics");
+    LOG_INFO("Disk  read %12lu Bytes in %8.3f sec  %8.2f Gbps\n", fsrc.read_bytes, disk_s, fsrc.read_bytes / (125000000 * disk_s));
+    LOG_INFO("Net  acked %12lu Bytes in %8.3f sec  %8.2f Gbps\n", acked_bytes, net_s, acked_bytes / (125000000 * net_s));
+    if (acked_bytes < fsrc.size)
+        LOG_WARN("Stopped early, %lu of %lu Bytes acked\n", acked_bytes, fsrc.size);
+    LOG_LINE(75, '-', NULL);
+    munmap(fsrc.addr, fsrc.size);
+    close(fsrc.fd);
+    fsrc.addr = NULL;
+}
+
+static int
+write_all(int fd, const char* buf, uint64_t len, uint64_t off) {
+    while (len > 0) {
+        ssize_t ret = pwrite(fd, buf, len, off);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += ret;
+        off += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static void*
+file_writer(__rte_unused void* arg) {
+    struct wblock_t* blk = NULL;
+    for (;;) {
+        if (rte_ring_dequeue(fsink.todo, (void**) &blk) != 0) {
+            if (fsink.stop == true)
+                break;
+            usleep(10);
+            continue;
+        }
+
+        uint64_t ts = rte_rdtsc();
+        int fd = (fsink.is_direct == true && blk->len % FILE_ALIGN == 0) ? fsink.fd : fsink.fd_buf;
+        if (write_all(fd, blk->addr, blk->len, blk->off) != 0) {
+            LOG_ERRO("Cannot write %u bytes at offset %lu: %s\n", blk->len, blk->off, strerror(errno));
+        } else {
+            fsink.written_bytes += blk->len;
+            fsink.end = RTE_MAX(fsink.end, blk->off + blk->len);
+        }
+        fsink.disk_cycles += rte_rdtsc() - ts;
+
+        blk->len = 0;
+        rte_ring_enqueue(fsink.sink[blk->thread_id].free, blk);
+    }
+    return NULL;
+}
+
+int
+file_open_sink(const char* path) {
+    struct conf_t* conf = get_conf();
+
+    fsink.is_direct = (conf->bufsize % FILE_ALIGN == 0);
+    fsink.fd_buf = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fsink.fd_buf < 0) {
+        LOG_ERRO("Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fsink.is_direct == true) {
+        fsink.fd = open(path, O_WRONLY | O_DIRECT);
+        if (fsink.fd < 0) {
+            LOG_WARN("O_DIRECT is not supported on %s, fall back to buffered I/O\n", path);
+            fsink.is_direct = false;
+        }
+    } else {
+        LOG_WARN("--bufsize is not a multiple of %d, fall back to buffered I/O\n", FILE_ALIGN);
+    }
+
+    // Ring sizes must be a power of 2, one slot is reserved
+    fsink.todo = rte_ring_create("FILE_TODO", rte_align32pow2(MAX_LCORE * FILE_BLOCKS + 1), rte_socket_id(), RING_F_SC_DEQ);
+    if (fsink.todo == NULL) {
+        LOG_ERRO("Cannot create rings for the file writer\n");
+        return -1;
+    }
+    for (int loop = 1; loop < conf->total_lcore; loop++) {
+        struct sink_t* sink = &fsink.sink[loop];
+        char name[20];
+        sprintf(name, "FILE_FREE_%d", loop);
+        sink->free = rte_ring_create(name, rte_align32pow2(FILE_BLOCKS + 1), rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (sink->free == NULL) {
+            LOG_ERRO("Cannot create rings for the file writer\n");
+            return -1;
+        }
+        for (int inner = 0; inner < FILE_BLOCKS; inner++) {
+            struct wblock_t* blk = rte_zmalloc(NULL, sizeof(struct wblock_t), 0);
+            if (blk != NULL)
+                blk->addr = rte_malloc(NULL, conf->bufsize, FILE_ALIGN);
+            if (blk == NULL || blk->addr == NULL) {
+                LOG_ERRO("Cannot allocate %lu bytes for staging blocks\n", conf->bufsize);
+                return -1;
+            }
+            blk->thread_id = loop;
+            rte_ring_enqueue(sink->free, blk);
+        }
+    }
+
+    fsink.stop = false;
+    if (pthread_create(&fsink.writer, NULL, file_writer, NULL) != 0) {
+        LOG_ERRO("Cannot create the file writer thread\n");
+        return -1;
+    }
+    LOG_INFO("Writing received payload to %s (%s, %d x %.2f MB staging blocks per thread)\n",
+        path, fsink.is_direct ? "O_DIRECT" : "buffered", FILE_BLOCKS, conf->bufsize / 1000000.0);
+    return 0;
+}
+
+int
+file_sink_put(uint16_t thread_id, const char* payload, uint16_t len) {
+    struct conf_t* conf = get_conf();
+    struct sink_t* sink = &fsink.sink[thread_id];
+    uint64_t chunk_off = sink->pos % conf->bufsize;
+
+    if (unlikely(sink->cur == NULL)) {
+        if (rte_ring_dequeue(sink->free, (void**) &sink->cur) != 0) {
+            sink->cur = NULL;
+            return -1;
+        }
+        sink->cur->off = ((sink->pos / conf->bufsize) * conf->num_thread + thread_id - 1) * conf->bufsize;
+    }
+
+    // The client never lets a segment span two chunks (tasks are `bufsize`
+    // long), this only clamps if --bufsize differs on both sides
+    len = RTE_MIN(len, conf->bufsize - chunk_off);
+    rte_memcpy(sink->cur->addr + chunk_off, payload, len);
+    sink->cur->len += len;
+    sink->pos += len;
+    if (sink->pos % conf->bufsize == 0) {
+        rte_ring_enqueue(fsink.todo, sink->cur);
+        sink->cur = NULL;
+    }
+
+    sink->last_tsc = rte_rdtsc();
+    if (unlikely(sink->first_tsc == 0))
+        sink->first_tsc = sink->last_tsc;
+    return 0;
+}
+
+void
+file_sink_flush(uint16_t thread_id) {
+    struct sink_t* sink = &fsink.sink[thread_id];
+    if (sink->cur != NULL && sink->cur->len > 0) {
+        rte_ring_enqueue(fsink.todo, sink->cur);
+        sink->cur = NULL;
+    }
+}
+
+void
+file_close_sink(void) {
+    struct conf_t* conf = get_conf();
+    if (fsink.fd_buf < 0)
+        return;
+
+    fsink.stop = true;
+    pthread_join(fsink.writer, NULL);
+    if (ftruncate(fsink.fd_buf, fsink.end) != 0)
+        LOG_WARN("Cannot truncate the file to %lu bytes\n", fsink.end);
+
+    uint64_t recv_bytes = 0, first_tsc = UINT64_MAX, last_tsc = 0;
+    for (int loop = 1; loop < conf->total_lcore; loop++) {
+        struct sink_t* sink = &fsink.sink[loop];
+        recv_bytes += sink->pos;
+        if (sink->first_tsc != 0) {
+            first_tsc = RTE_MIN(first_tsc, sink->first_tsc);
+            last_tsc  = RTE_MAX(last_tsc, sink->last_tsc);
+        }
+        struct wblock_t* blk = NULL;
+        while (rte_ring_dequeue(sink->free, (void**) &blk) == 0) {
+            rte_free(blk->addr);
+            rte_free(blk);
+        }
+        rte_ring_free(sink->free);
+    }
+    rte_ring_free(fsink.todo);
+
+    double disk_s = hz_to_ns(fsink.disk_cycles) / 1000000000.0;
+    double net_s  = (last_tsc > first_tsc) ? hz_to_ns(last_tsc - first_tsc) / 1000000000.0 : 0;
+    LOG_LINE(75, '-', "File Statistics");
+    LOG_INFO("Net   recv %12lu Bytes in %8.3f sec  %8.2f Gbps\n", recv_bytes, net_s, net_s > 0 ? recv_bytes / (125000000 * net_s) : 0);
+    LOG_INFO("Disk write %12lu Bytes in %8.3f sec  %8.2f Gbps\n", fsink.written_bytes, disk_s, disk_s > 0 ? fsink.written_bytes / (125000000 * disk_s) : 0);
+    LOG_LINE(75, '-', NULL);
+
+    if (fsink.fd >= 0)
+        close(fsink.fd);
+    close(fsink.fd_buf);
+    fsink.fd_buf = -1;
+}
@@ -0,0 +1,108 @@
+#ifndef _FILE_H_
+#define _FILE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "conf.h"
+
+/**
+ * Number of staging blocks per server thread, each holds one `bufsize` chunk
+ */
+#define FILE_BLOCKS           4
+/**
+ * Alignment required by O_DIRECT
+ */
+#define FILE_ALIGN            4096
+
+/**
+ * A chunk of received payload waiting to be written to the file
+ */
+struct wblock_t {
+    char* addr;
+    uint64_t off;               // Offset in the file
+    uint32_t len;               // Number of valid bytes
+    uint16_t thread_id;         // Owner thread, the block goes back to its free ring
+};
+
+/**
+ * mmap the source file for the client (-F)
+ *
+ * @para path
+ *   Path to the file
+ * @return
+ *   - 0: Success
+ *   - -1: Otherwise
+ */
+int file_open_src(const char* path);
+
+/**
+ * Size of the source file in bytes
+ */
+uint64_t file_src_size(void);
+
+/**
+ * Get the `chunk_id`-th `bufsize` chunk of the source file. Pages of the chunk are
+ * faulted in here (i.e., read from disk) so that the sending thread only copies
+ * from the page cache, and the time spent is accounted as disk time.
+ *
+ * @para chunk_id
+ *   Index of the chunk
+ * @para len
+ *   (OUT) Length of the chunk
+ * @return
+ *   Address of the chunk, NULL if beyond the end of the file
+ */
+char* file_src_chunk(uint64_t chunk_id, uint64_t* len);
+
+/**
+ * Report disk vs network throughput and unmap the source file
+ *
+ * @para acked_bytes
+ *   Bytes of the file the server has acknowledged
+ */
+void file_close_src(uint64_t acked_bytes);
+
+/**
+ * Open the sink file for the server (-F), allocate staging blocks and start
+ * the writer thread.
+ *
+ * @para path
+ *   Path to the file, truncated if it exists
+ * @return
+ *   - 0: Success
+ *   - -1: Otherwise
+ */
+int file_open_sink(const char* path);
+
+/**
+ * Append in-order payload of a server thread. Thread i's stream is made up of
+ * chunks i-1, i-1+num_thread, ... of the client's file, so the file is rebuilt
+ * as long as -P and --bufsize match on both sides.
+ *
+ * @para thread_id
+ *   ID of the server thread (1 .. num_thread)
+ * @para payload
+ *   Payload of the segment
+ * @para len
+ *   Length of the payload
+ * @return
+ *   - 0: Success
+ *   - -1: No staging block is free (disk is the bottleneck), drop the segment
+ */
+int file_sink_put(uint16_t thread_id, const char* payload, uint16_t len);
+
+/**
+ * Hand the partially filled block of a server thread to the writer
+ *
+ * @para thread_id
+ *   ID of the server thread
+ */
+void file_sink_flush(uint16_t thread_id);
+
+/**
+ * Drain and stop the writer, report disk vs network throughput and close the file
+ */
+void file_close_sink(void);
+
+#endif
@@ -38,21 +38,91 @@
 #include "core.h"
 #include "stat.h"
 #include "list.h"
+#include "file.h"
+#include "fct.h"
+#include "pmu.h"
+#include "result.h"
+#include "sweep.h"
+
+/**
+ * Wall-clock breakdown of the startup, each phase ends where the next begins.
+ * It is printed once, when the main lcore starts measuring.
+ */
+#define MAX_PHASE 10
+static struct timeval phase_start;
+static struct timeval phase_ts[MAX_PHASE];
+static const char* phase_name[MAX_PHASE];
+static int num_phase = 0;
+static bool phase_printed = false;
+
+static void
+phase_end(const char* name) {
+    if (num_phase == MAX_PHASE || phase_printed == true)
+        return;
+    phase_name[num_phase] = name;
+    gettimeofday(&phase_ts[num_phase++], NULL);
+}
+
+static void
+print_phases(void) {
+    if (phase_printed == true)
+        return;
+    phase_printed = true;
+    LOG_LINE(75, '-', "Startup");
+    struct timeval last = phase_start;
+    for (int loop = 0; loop < num_phase; loop++) {
+        LOG_INFO("  %-32s %10.1f ms\n", phase_name[loop], time_diff(last, phase_ts[loop]) * 1000);
+        last = phase_ts[loop];
+    }
+    if (num_phase > 0)
+        LOG_INFO("  %-32s %10.1f ms\n", "Total", time_diff(phase_start, last) * 1000);
+    LOG_LINE(75, '-', NULL);
+}
+
+/**
+ * Print the reports of a finished run and append its results record
+ */
+static void
+report(void) {
+    struct conf_t* conf = get_conf();
+    exit_stat();
+    if (conf->is_rtt == false)
+        print_app(conf);
+    if (conf->is_pmu == true) {
+        print_pmu(conf);
+        pmu_close(conf);
+    }
+    if (conf->is_client == true && conf->is_rtt == false && conf->data_size > 0)
+        print_sched(conf);
+    if (conf->is_client == true && conf->is_rr == true)
+        print_rr(conf);
+    if (conf->is_client == true && conf->is_pps == true)
+        print_pps(conf);
+    if ((conf->is_server == true || conf->is_loopback == true) && conf->is_verify == true)
+        print_verify(conf);
+    result_save(conf);
+}
 
 void stop(void) {
     struct conf_t* conf = get_conf();
     LOG_WARN("Closing and releasing resources ...\n");
 
-    exit_stat();
+    // Every trial of --sweep is reported as it ends
+    if (strlen(conf->sweep) == 0)
+        report();
+    if (conf->is_server == true && conf->is_file == true)
+        file_close_sink();
 
     LOG_INFO("Freeing mempool resources for conn ...\n");
     for (int loop = 0; loop < conf->total_lcore; loop++) {
         rte_mempool_free(conf->conn[loop].mbuf_pool);
     }
 
-    LOG_INFO("Stopping and clossing Port %hu ...\n", conf->port_id);
-    rte_eth_dev_stop(conf->port_id);
-    rte_eth_dev_close(conf->port_id);
+    for (int loop = 0; loop < conf->num_port; loop++) {
+        LOG_INFO("Stopping and clossing Port %hu ...\n", conf->ports[loop]);
+        rte_eth_dev_stop(conf->ports[loop]);
+        rte_eth_dev_close(conf->ports[loop]);
+    }
     exit_core(conf);
 }
 
@@ -80,6 +150,27 @@ void recv_test(struct conn_t* conn) {
     }
 }
 
+/**
+ * Fill the task with the `task_id`-th chunk of the transfer and dispatch it.
+ * Thread i gets tasks i, i+num_thread, ..., each thread transfers data_size
+ * bytes (-n) or loops over bufsize bytes (-t). With -F, task i is the i-th
+ * chunk of the file and `addr` is ignored.
+ */
+static inline int
+task_issue(struct conf_t* conf, uint64_t task_id, char* addr, uint32_t* crc) {
+    struct task_t task = {0};
+    uint64_t off = (task_id / conf->num_thread) * conf->bufsize;
+    task.ID   = task_id;
+    task.addr = addr;
+    task.crc  = crc;
+    task.len  = conf->bufsize;
+    if (conf->is_file == true)
+        task.addr = file_src_chunk(task_id, &task.len);
+    else if (conf->data_size > 0)
+        task.len = RTE_MIN(conf->bufsize, conf->data_size - off);
+    return task_enqueue(&task);
+}
+
 int
 lcore_daemon(struct conn_t* arg) {
     struct conn_t* conn = arg;
@@ -89,74 +180,115 @@ lcore_daemon(struct conn_t* arg) {
     struct conf_t* conf = get_conf();
     uint64_t alltime = rte_get_timer_hz() * time_double(conf->all_time);
 
-    struct list_t* list = list_alloc();
-    if (conf->is_client == true && conf->is_rtt == false) {
-        uint64_t off = 0;
-        uint64_t data_size = conf->data_size;
-        if (conf->data_size == 0) {
-            data_size = 10 * conf->bufsize;
+    uint64_t num_task = 0;
+    uint64_t next_id  = 0;
+    uint64_t window   = 0;          // Tasks issued up front, a thread's next chunk is window IDs on
+    uint32_t num_buf  = 0;
+    char**   bufs     = NULL;
+    uint32_t** crcs   = NULL;
+    if (conf->is_client == true && conf->is_rtt == false && conf->is_fct == true) {
+        print_phases();
+        init_stat();
+        fct_run();
+        set_quit();
+        rte_eal_mp_wait_lcore();
+        return 0;
+    } else if (conf->is_client == true && conf->is_rtt == false && conf->is_file == true) {
+        if (file_open_src(conf->file_path) != 0)
+            exit(-1);
+        phase_end("Source file");
+        // Chunks are mmapped, only bound the number of chunks in flight
+        num_task = (file_src_size() + conf->bufsize - 1) / conf->bufsize;
+        for (next_id = 0; next_id < RTE_MIN(num_task, conf->num_thread * TASK_DEPTH); next_id++) {
+            task_issue(conf, next_id, NULL, NULL);
+        }
+        window = next_id;
+    } else if (conf->is_client == true && conf->is_rtt == false && conf->is_rr == false && conf->is_pps == false) {
+        num_buf = conf->num_thread * TASK_DEPTH;
+        if (conf->data_size > 0) {
+            num_task = conf->num_thread * ((conf->data_size + conf->bufsize - 1) / conf->bufsize);
+            num_buf  = RTE_MIN(num_buf, num_task);
+        } else {
+            num_task = num_buf;
         }
-        uint64_t inc_id = 0;
-        while (off < data_size) {
-            for (int loop = 0; loop < conf->num_thread; loop++) {
-                uint64_t len = RTE_MIN(conf->bufsize, data_size - off);
-                char* addr = (char* ) malloc(len * sizeof(char));
-                // for (uint64_t iter = 0; iter < len; iter+=1024) {
-                //     addr[iter] = '0';
-                // }
-                // char* addr = (char* ) rte_malloc(NULL, len * sizeof(char), 0);
-                // char* addr = (char* ) rte_zmalloc_socket(NULL, len * sizeof(char), 0, ((int) rte_socket_id()));
-
-                struct task_t* task = (struct task_t* ) malloc(sizeof(struct task_t));
-                task->addr = addr;
-                task->len = len;
-                // task->ID = loop;
-                task->ID = inc_id++;
-                list_append(list, (struct list_item_t*) task);
+
+        // Hugepage-backed buffers on the NIC's NUMA node, zeroed here so that
+        // no page fault happens during the measurement
+        int socket_id = rte_eth_dev_socket_id(conn->port_id);
+        if (socket_id < 0)
+            socket_id = rte_socket_id();
+        bufs = (char**) calloc(num_buf, sizeof(char*));
+        crcs = (uint32_t**) calloc(num_buf, sizeof(uint32_t*));
+        for (uint32_t loop = 0; loop < num_buf; loop++) {
+            bufs[loop] = (char*) rte_zmalloc_socket(NULL, conf->bufsize, RTE_CACHE_LINE_SIZE, socket_id);
+            if (bufs[loop] == NULL) {
+                LOG_ERRO("Cannot allocate %lu bytes for task buffer %u on socket %d\n", conf->bufsize, loop, socket_id);
+                exit(-1);
+            }
+            if (conf->pattern != PATTERN_ZERO)
+                task_fill(bufs[loop], conf->bufsize, loop);
+            if (conf->is_verify == true) {
+                crcs[loop] = task_crc(bufs[loop], conf->bufsize, socket_id);
+                if (crcs[loop] == NULL) {
+                    LOG_ERRO("Cannot allocate CRC table for task buffer %u on socket %d\n", loop, socket_id);
+                    exit(-1);
+                }
             }
-            off = off + conf->bufsize;
         }
-    }
+        LOG_INFO("Allocated %u task buffers (%.2f MB) on socket %d\n", num_buf, num_buf * conf->bufsize / 1000000.0, socket_id);
+        phase_end("Task buffers (allocate and fill)");
 
-    struct task_t* iter = NULL;
-    YC_LIST_FOREACH(iter, list, struct task_t) {
-        task_enqueue(iter);
+        for (next_id = 0; next_id < num_buf; next_id++) {
+            task_issue(conf, next_id, bufs[next_id], crcs[next_id]);
+        }
+        window = next_id;
     }
 
+    print_phases();
     init_stat();
 
-    uint32_t counter = 0;
-    struct task_t* task = NULL;
+    uint64_t counter = 0;
+    struct task_t task;
     if (conf->is_client == true && (conf->is_rtt == true || conf->data_size > 0)) {
         for (;;) {
-            task = task_dequeue();
-            if (task != NULL) {
+            if (task_dequeue(&task) == 0) {
                 counter++;
-                if (counter == list->length) {
+                if (counter == num_task) {
                     set_quit();
                     break;
                 }
+                // Recycle the buffer for the next chunk of the same thread,
+                // so that every thread moves on at its own pace
+                if (task.ID + window < num_task)
+                    task_issue(conf, task.ID + window, task.addr, task.crc);
             }
             if (conf->is_rtt == true)
                 break;
         }
 
         rte_eal_mp_wait_lcore();
+        if (conf->is_file == true) {
+            const struct app_stat_t* app = get_app_stat();
+            uint64_t acked_bytes = 0;
+            for (int loop = 1; loop < conf->total_lcore; loop++)
+                acked_bytes += app[loop].acked_bytes;
+            file_close_src(acked_bytes);
+        }
 
-        YC_LIST_FOREACH(iter, list, struct task_t) {
-            free(iter->addr);
-            // rte_free(iter->addr);
+        for (uint32_t loop = 0; loop < num_buf; loop++) {
+            rte_free(bufs[loop]);
+            rte_free(crcs[loop]);
         }
-        list_free(list);
+        free(bufs);
+        free(crcs);
         return 0;
     }
 
     volatile bool* force_quit = get_quit();
     while(likely(!(*force_quit))) {
-        task = task_dequeue();
-        if (task != NULL) {
+        if (task_dequeue(&task) == 0) {
             if (conf->data_size == 0)
-                task_enqueue(task);
+                task_enqueue(&task);
         }
         if (counter == 1000) {
             int ret = update_stat(alltime);
@@ -176,25 +308,70 @@ lcore_daemon(struct conn_t* arg) {
 
     rte_eal_mp_wait_lcore();
 
-    YC_LIST_FOREACH(iter, list, struct task_t) {
-        free(iter->addr);
-        // rte_free(iter->addr);
+    for (uint32_t loop = 0; loop < num_buf; loop++) {
+        rte_free(bufs[loop]);
+        rte_free(crcs[loop]);
     }
-    list_free(list);
+    free(bufs);
+    free(crcs);
     return 0;
 }
 
+static void
+launch_lcores(struct conf_t* conf) {
+    LOG_INFO("Launching lcore daemon ...\n");
+    for (int loop = 1; loop < conf->total_lcore; loop++) {
+        if (conf->is_server == true || conf->conn[loop].is_server == true) {
+            LOG_INFO("  -- launch "CO_RED"lcore_server"CO_RESET" on lcore %u (Thread %u)\n", conf->conn[loop].lcore_id, conf->conn[loop].ID);
+            rte_eal_remote_launch(lcore_server, &conf->conn[loop], conf->conn[loop].lcore_id);
+        } else if (conf->is_client == true) {
+            LOG_INFO("  -- launch "CO_YELLOW"lcore_client"CO_RESET" on lcore %u (Thread %u)\n", conf->conn[loop].lcore_id, conf->conn[loop].ID);
+            rte_eal_remote_launch(lcore_client, &conf->conn[loop], conf->conn[loop].lcore_id);
+        }
+    }
+}
+
+/**
+ * Run the remaining trials of --sweep in this EAL session, the first one has
+ * run already. Ports keep their configuration and flow rules, only queues and
+ * pools are set up again.
+ */
+static void
+run_sweep(struct conf_t* conf) {
+    uint32_t trial = 0;
+    for (;;) {
+        report();
+        sweep_record(trial);
+        result_reset();
+        trial++;
+        if (trial == sweep_num_trial() || reset_quit() != 0)
+            break;
+
+        sweep_apply(trial);
+        if (port_reconfigure() != 0) {
+            LOG_ERRO("Cannot reconfigure the ports, stop sweeping\n");
+            break;
+        }
+        exit_core(conf);
+        init_core(conf);
+        launch_lcores(conf);
+        lcore_daemon(&conf->conn[0]);
+    }
+    sweep_report(trial);
+}
+
 int
 main(int argc, char** argv) {
+    gettimeofday(&phase_start, NULL);
     opt_parser(argc, argv);
 
     char** my_argv = (char**) calloc(MAX_ARGC, sizeof(char*));
     for (int loop = 0; loop < MAX_ARGC; loop++)
         my_argv[loop] = (char*) calloc(LEN_ARGV, sizeof(char));
     int my_argc = opt_genargv(argv[0], my_argv);
+    phase_end("Options and lcore mask");
 
     int ret = 0;
-    unsigned nb_ports = 0;
 
     optind = 1;
     LOG_INFO("Initilizing EAL ...\n");
@@ -208,42 +385,53 @@ main(int argc, char** argv) {
     } else {
         LOG_INFO("EAL initialization done!\n");
     }
-
-    nb_ports = rte_eth_dev_count_avail();
-    if (nb_ports < 2 || (nb_ports & 1)) {
-        LOG_ERRO("Number of ports must be even [%u Port(s) Detected]\n", nb_ports);
-    } else {
-        LOG_INFO("%u ports detected\n", nb_ports);
-    }
+    init_cycles();
+    phase_end("EAL");
 
     signal(SIGINT,  signal_handler);
     signal(SIGTERM, signal_handler);
 
     struct conf_t* conf = get_conf();
+    if (strlen(conf->sweep) > 0)
+        sweep_apply(0);
 
     init_conn();
+    // Ring pair ports only exist once init_conn() has created them
+    for (uint16_t loop = 0; loop < conf->num_port; loop++) {
+        bool dup = false;
+        for (uint16_t prev = 0; prev < loop; prev++)
+            dup |= (conf->ports[prev] == conf->ports[loop]);
+        if (rte_eth_dev_is_valid_port(conf->ports[loop]) == 0 || dup == true) {
+            LOG_ERRO("Port %hu is not a distinct, usable port [%hu port(s) needed, %hu detected]\n",
+                conf->ports[loop], conf->num_port, rte_eth_dev_count_avail());
+            exit(-1);
+        }
+    }
+    LOG_INFO("%hu of %hu detected port(s) in use\n", conf->num_port, rte_eth_dev_count_avail());
+    phase_end("Threads, pools and neighbours");
     if (init_port() == -1) {
         LOG_ERRO("Initilize port failed!\n");
         exit(-1);
     }
+    phase_end("Ports and links");
     init_flow();
+    phase_end("Flow rules and RSS");
     init_core(conf);
+    if (conf->is_server == true && conf->is_file == true && file_open_sink(conf->file_path) != 0) {
+        LOG_ERRO("Cannot set up the file writer!\n");
+        exit(-1);
+    }
 
     // uint16_t client_id = 1;
     // uint16_t server_id = 1;
-    LOG_INFO("Launching lcore daemon ...\n");
-    for (int loop = 1; loop < conf->total_lcore; loop++) {
-        if (conf->is_server == true) {
-            LOG_INFO("  -- launch "CO_RED"lcore_server"CO_RESET" on lcore %u (Thread %u)\n", conf->conn[loop].lcore_id, conf->conn[loop].ID);
-            rte_eal_remote_launch(lcore_server, &conf->conn[loop], conf->conn[loop].lcore_id);
-        } else if (conf->is_client == true) {
-            LOG_INFO("  -- launch "CO_YELLOW"lcore_client"CO_RESET" on lcore %u (Thread %u)\n", conf->conn[loop].lcore_id, conf->conn[loop].ID);
-            rte_eal_remote_launch(lcore_client, &conf->conn[loop], conf->conn[loop].lcore_id);
-        }
-    }
+    phase_end("Task queues");
+    launch_lcores(conf);
+    phase_end("Launch");
 
     LOG_INFO("Press Ctl+C to exit...\n");
     lcore_daemon(&conf->conn[0]);
+    if (strlen(conf->sweep) > 0)
+        run_sweep(conf);
 
     // rte_eal_mp_wait_lcore();
     stop();
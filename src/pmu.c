@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <rte_common.h>
+
+#include "util.h"
+#include "conf.h"
+#include "core.h"
+#include "pmu.h"
+#include "result.h"
+
+struct pmu_t pmu[MAX_LCORE];
+
+static const char* pmu_name[NUM_PMU] = {"cycles", "instructions", "LLC-load-misses", "branch-misses"};
+
+static void
+pmu_attr(int event, struct perf_event_attr* attr) {
+    memset(attr, 0, sizeof(struct perf_event_attr));
+    attr->size           = sizeof(struct perf_event_attr);
+    attr->exclude_kernel = 1;
+    attr->exclude_hv     = 1;
+    attr->read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (event) {
+    case PMU_CYCLES:
+        attr->type   = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PMU_INSTRUCTIONS:
+        attr->type   = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PMU_LLC_MISSES:
+        attr->type   = PERF_TYPE_HW_CACHE;
+        attr->config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case PMU_BRANCH_MISSES:
+        attr->type   = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    }
+}
+
+int
+pmu_open(uint16_t thread_id) {
+    struct pmu_t* p = &pmu[thread_id];
+    struct perf_event_attr attr;
+    int opened = 0;
+
+    for (int event = 0; event < NUM_PMU; event++) {
+        pmu_attr(event, &attr);
+        // pid 0, cpu -1: the calling thread, wherever it runs
+        p->fd[event] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (p->fd[event] < 0) {
+            if (thread_id == 1)
+                LOG_WARN("Cannot open perf event %s: %s\n", pmu_name[event], strerror(errno));
+            continue;
+        }
+        p->pre[event] = 0;
+        opened++;
+    }
+    if (opened == 0 && thread_id == 1)
+        LOG_WARN("No perf event is available (check perf_event_paranoid), ignore --pmu\n");
+    p->ready = true;
+    return (opened > 0) ? 0 : -1;
+}
+
+void
+pmu_read(uint16_t thread_id, uint64_t* val, uint64_t* delta) {
+    struct pmu_t* p = &pmu[thread_id];
+    uint64_t buf[3];   // value, time enabled, time running
+
+    for (int event = 0; event < NUM_PMU; event++) {
+        val[event] = UINT64_MAX;
+        if (p->ready == false || p->fd[event] < 0 || read(p->fd[event], buf, sizeof(buf)) != sizeof(buf))
+            continue;
+        // Scale up if the event was multiplexed with others
+        val[event] = (buf[2] > 0 && buf[2] < buf[1]) ? (uint64_t) ((double) buf[0] * buf[1] / buf[2]) : buf[0];
+        if (delta != NULL) {
+            delta[event]  = val[event] - p->pre[event];
+            p->pre[event] = val[event];
+        }
+    }
+    if (delta != NULL) {
+        for (int event = 0; event < NUM_PMU; event++) {
+            if (val[event] == UINT64_MAX)
+                delta[event] = UINT64_MAX;
+        }
+    }
+}
+
+static inline double
+per_pkt(uint64_t value, uint64_t pkts) {
+    return (value == UINT64_MAX || pkts == 0) ? 0 : (double) value / pkts;
+}
+
+void
+print_pmu(struct conf_t* conf) {
+    const struct app_stat_t* app = get_app_stat();
+    uint64_t val[NUM_PMU];
+    uint64_t all_pkts = 0, all_cycles = 0, all_instr = 0;
+
+    LOG_LINE(75, '-', "PMU Statistics");
+    LOG_INFO("Thread       Packets     IPC    Cyc/Pkt  LLC-Miss/Pkt  Br-Miss/Pkt\n");
+    for (int loop = 1; loop < conf->total_lcore; loop++) {
+        pmu_read(loop, val, NULL);
+        uint64_t pkts = app[loop].sent_pkts + app[loop].acked_pkts;
+        double ipc = (val[PMU_CYCLES] == UINT64_MAX || val[PMU_INSTRUCTIONS] == UINT64_MAX || val[PMU_CYCLES] == 0) ?
+            0 : (double) val[PMU_INSTRUCTIONS] / val[PMU_CYCLES];
+        LOG_INFO("  %02d  %12lu  %6.2f  %9.1f  %12.3f  %11.3f\n",
+            loop, pkts, ipc,
+            per_pkt(val[PMU_CYCLES], pkts),
+            per_pkt(val[PMU_LLC_MISSES], pkts),
+            per_pkt(val[PMU_BRANCH_MISSES], pkts));
+        if (val[PMU_CYCLES] != UINT64_MAX && val[PMU_INSTRUCTIONS] != UINT64_MAX) {
+            all_pkts   += pkts;
+            all_cycles += val[PMU_CYCLES];
+            all_instr  += val[PMU_INSTRUCTIONS];
+        }
+    }
+    LOG_LINE(75, '-', NULL);
+    if (all_cycles > 0) {
+        result_set(RES_IPC, (double) all_instr / all_cycles);
+        if (all_pkts > 0)
+            result_set(RES_CYC_PKT, (double) all_cycles / all_pkts);
+    }
+}
+
+void
+pmu_close(struct conf_t* conf) {
+    for (int loop = 1; loop < conf->total_lcore; loop++) {
+        if (pmu[loop].ready == false)
+            continue;
+        pmu[loop].ready = false;
+        for (int event = 0; event < NUM_PMU; event++) {
+            if (pmu[loop].fd[event] >= 0)
+                close(pmu[loop].fd[event]);
+            pmu[loop].fd[event] = -1;
+        }
+    }
+}
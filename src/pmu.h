@@ -0,0 +1,69 @@
+#ifndef _PMU_H_
+#define _PMU_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "conf.h"
+
+/**
+ * Hardware events counted per worker thread (--pmu)
+ */
+#define PMU_CYCLES            0
+#define PMU_INSTRUCTIONS      1
+#define PMU_LLC_MISSES        2
+#define PMU_BRANCH_MISSES     3
+#define NUM_PMU               4
+
+/**
+ * Counters of a worker thread. Each event has its own fd so that the ones the
+ * CPU (or hypervisor) does not expose are skipped individually.
+ */
+struct pmu_t {
+    int fd[NUM_PMU];            // -1 if the event is not available
+    uint64_t pre[NUM_PMU];      // Values at the previous interval
+    volatile bool ready;        // fd[] is valid, set by the worker once opened
+} __rte_cache_aligned;
+
+/**
+ * Open the hardware counters for the calling worker thread. Must run on the
+ * worker itself, counting follows the thread.
+ *
+ * @para thread_id
+ *   ID of the worker thread (1 .. num_thread)
+ * @return
+ *   - 0: At least one counter is open
+ *   - -1: perf events are not available, --pmu is ignored for this thread
+ */
+int pmu_open(uint16_t thread_id);
+
+/**
+ * Read the counters of a worker thread, scaled for multiplexing
+ *
+ * @para thread_id
+ *   ID of the worker thread
+ * @para val
+ *   (OUT) NUM_PMU values since pmu_open(), UINT64_MAX for events not available
+ * @para delta
+ *   (OUT, optional) NUM_PMU values since the previous call with `delta` set
+ */
+void pmu_read(uint16_t thread_id, uint64_t* val, uint64_t* delta);
+
+/**
+ * Print IPC and per-packet cycles, LLC misses and branch misses of each
+ * worker thread since the start
+ *
+ * @para conf
+ *   Global configuration
+ */
+void print_pmu(struct conf_t* conf);
+
+/**
+ * Close the counters of all worker threads
+ *
+ * @para conf
+ *   Global configuration
+ */
+void pmu_close(struct conf_t* conf);
+
+#endif
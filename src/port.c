@@ -8,15 +8,38 @@
 
 #include <rte_timer.h>
 #include <rte_ethdev.h>
+#include <rte_thash.h>
+#include <rte_eth_ring.h>
+#include <rte_vxlan.h>
 
 #include "port.h"
 #include "util.h"
 #include "conf.h"
 
+/**
+ * Largest RETA among supported PMDs (ice)
+ */
+#define MAX_RETA_SIZE         2048
+/**
+ * Largest Toeplitz key among supported PMDs
+ */
+#define MAX_HASH_KEY_SIZE     64
+
+// Key programmed into the port, conf->rss_key repeated up to hash_key_size
+static uint8_t rss_key[MAX_HASH_KEY_SIZE];
+static bool rss_enabled[MAX_PORT] = {false};
+// Offloads the port is configured with, the queues of a sweep trial reuse them
+static uint64_t rx_offloads[MAX_PORT];
+static uint64_t tx_offloads[MAX_PORT];
+// Descriptors per queue after rte_eth_dev_adjust_nb_rx_tx_desc()
+static uint16_t nb_rxd[MAX_PORT];
+static uint16_t nb_txd[MAX_PORT];
+
 static inline void
-print_dev_conf(uint16_t port_id) {
+print_dev_conf(uint16_t index, uint16_t num_queue) {
     struct conf_t* conf = get_conf();
-    char if_name[20];
+    uint16_t port_id = conf->ports[index];
+    char if_name[IF_NAMESIZE] = "-";
 
     struct rte_ether_addr addr;
     struct rte_eth_dev_info dev_info;
@@ -24,7 +47,8 @@ print_dev_conf(uint16_t port_id) {
     rte_eth_dev_info_get(port_id, &dev_info);
     LOG_INFO("Showing configuration for port %hu ...\n", port_id);
     LOG_LINE(75, '-', "Port Configuration");
-    if_indextoname(dev_info.if_index, if_name);
+    if (dev_info.if_index == 0 || if_indextoname(dev_info.if_index, if_name) == NULL)
+        strcpy(if_name, "-");
     LOG_INFO("Ethernet interface %s is on NUMA Node (Socket) %d\n", if_name, dev_info.device->numa_node);
     LOG_INFO("Device Info, Driver: %s, MAC: %02"PRIx8":%02"PRIx8":%02"PRIx8":%02"PRIx8":%02"PRIx8":%02"PRIx8", PCI: %s\n",
         dev_info.driver_name,
@@ -37,7 +61,7 @@ print_dev_conf(uint16_t port_id) {
     LOG_INFO("RX:      %2hu    %4hu      %5d      %5hu      %2hu     %4hu        %2hu\n",
         dev_info.nb_rx_queues,
         dev_info.max_rx_queues,
-        conf->total_lcore * SIZE_RING_RX,
+        num_queue * nb_rxd[index],
         dev_info.rx_desc_lim.nb_max,
         dev_info.default_rxportconf.burst_size,
         dev_info.default_rxportconf.ring_size,
@@ -46,7 +70,7 @@ print_dev_conf(uint16_t port_id) {
     LOG_INFO("TX:      %2hu    %4hu      %5d      %5hu      %2hu     %4hu        %2hu\n",
         dev_info.nb_tx_queues,
         dev_info.max_tx_queues,
-        conf->total_lcore * SIZE_RING_TX,
+        num_queue * nb_txd[index],
         dev_info.tx_desc_lim.nb_max,
         dev_info.default_txportconf.burst_size,
         dev_info.default_txportconf.ring_size,
@@ -59,28 +83,84 @@ static inline void
 assert_link_status(uint16_t port_id) {
     LOG_INFO("Asserting link status for Port %hu ...", port_id);
     struct rte_eth_link link;
-    uint8_t rep_cnt = 9; /* 9s (9 * 1000ms) in total */
+    uint64_t hz = rte_get_timer_hz();
+    uint64_t start = rte_get_timer_cycles();
+    uint64_t deadline = start + 9 * hz; /* 9s in total, polled every 1ms */
     memset(&link, 0, sizeof(link));
-    do {
+    for (;;) {
         rte_eth_link_get_nowait(port_id, &link);
-        if (link.link_status == ETH_LINK_UP)
+        if (link.link_status == ETH_LINK_UP || rte_get_timer_cycles() >= deadline)
             break;
-        rte_delay_ms(1000);
-    } while (--rep_cnt);
+        rte_delay_ms(1);
+    }
     if (link.link_status == ETH_LINK_DOWN)
         rte_exit(EXIT_FAILURE, ":: error: link is still down\n");
     else
-        printf(" Done\n");
+        printf(" Done (%.0f ms)\n", (double) (rte_get_timer_cycles() - start) * 1000 / hz);
 }
 
-int
-init_port(void) {
+/**
+ * Set up the RX/TX queues of the `index`-th port with the descriptors and the
+ * mbuf pools in the global configuration, the port is configured or stopped
+ */
+static int
+setup_queues(uint16_t index) {
+    struct conf_t* conf = get_conf();
+    struct conn_t* conn_arr = conf->conn;
+    uint16_t port_id = conf->ports[index];
+    int socket_id = rte_eth_dev_socket_id(port_id);
+
+    struct rte_eth_dev_info dev_info;
+    rte_eth_dev_info_get(port_id, &dev_info);
+    struct rte_eth_txconf txq_conf = dev_info.default_txconf;
+    struct rte_eth_rxconf rxq_conf = dev_info.default_rxconf;
+    txq_conf.offloads = tx_offloads[index];
+    rxq_conf.offloads = rx_offloads[index];
+
+    nb_rxd[index] = conf->ring_rx;
+    nb_txd[index] = conf->ring_tx;
+    int ret = rte_eth_dev_adjust_nb_rx_tx_desc(port_id, &nb_rxd[index], &nb_txd[index]);
+    if (ret != 0) {
+        LOG_ERRO("Cannot adjust the number of descriptors of port %hu\n", port_id);
+        return ret;
+    }
+    if (nb_rxd[index] != conf->ring_rx || nb_txd[index] != conf->ring_tx)
+        LOG_WARN("Port %hu takes %hu RX and %hu TX descriptors per queue\n", port_id, nb_rxd[index], nb_txd[index]);
+
+    // Queue 0 of the other ports has no thread, it takes the first thread's pool
+    if (index > 0) {
+        ret = rte_eth_rx_queue_setup(port_id, 0, nb_rxd[index], socket_id, &rxq_conf, conn_arr[0].mbuf_pool);
+        if (ret < 0)
+            return ret;
+        ret = rte_eth_tx_queue_setup(port_id, 0, nb_txd[index], socket_id, &txq_conf);
+        if (ret < 0)
+            return ret;
+    }
+    for (uint16_t q_id = 0; q_id < conf->total_lcore; q_id++) {
+        struct conn_t conn = conn_arr[q_id];
+        if (conn.port_index != index)
+            continue;
+        ret = rte_eth_rx_queue_setup(port_id, conn.queue_id, nb_rxd[index], socket_id, &rxq_conf, conn.mbuf_pool);
+        if (ret < 0)
+            return ret;
+        ret = rte_eth_tx_queue_setup(port_id, conn.queue_id, nb_txd[index], socket_id, &txq_conf);
+        if (ret < 0)
+            return ret;
+        LOG_INFO("  -- set up "CO_RED"rx %hu"CO_RESET" (%hu receive descs) and "CO_YELLOW"tx %hu"CO_RESET" (%hu transmit descs)\n", conn.queue_id, nb_rxd[index], conn.queue_id, nb_txd[index]);
+    }
+    return 0;
+}
+
+/**
+ * Configure and start the `index`-th port with the queues of its threads
+ */
+static int
+_init_port(uint16_t index) {
     struct conf_t* conf = get_conf();
 
     int ret = 0;
-    uint16_t num_queue = conf->total_lcore;
-    struct conn_t* conn_arr = conf->conn;
-    uint16_t port_id = conf->port_id;
+    uint16_t num_queue = conf->num_queue[index];
+    uint16_t port_id = conf->ports[index];
     // ret = rte_eth_dev_get_port_by_name(conf->port_name, &port_id);
     // if (ret != 0) {
     //     LOG_ERRO("Cannot find the device %s\n", conf->port_name);
@@ -95,16 +175,63 @@ init_port(void) {
     struct rte_eth_dev_info dev_info;
     rte_eth_dev_info_get(port_id, &dev_info);
 
+    // Frames above the largest one of the threads are dropped, so that the
+    // mbufs fitted to it need no scatter
+    uint32_t max_frame = conf->frame_size;
     struct rte_eth_conf port_conf = {
         .rxmode = {
-            .max_rx_pkt_len = RTE_ETHER_MAX_LEN,
+            .max_rx_pkt_len = max_frame,
         },
     };
+    if (max_frame > RTE_ETHER_MAX_LEN) {
+        if (!(dev_info.rx_offload_capa & DEV_RX_OFFLOAD_JUMBO_FRAME) || dev_info.max_rx_pktlen < max_frame) {
+            LOG_ERRO("Port %hu does not receive %u Bytes frames (max %u)\n", port_id, max_frame, dev_info.max_rx_pktlen);
+            return -1;
+        }
+        port_conf.rxmode.offloads |= DEV_RX_OFFLOAD_JUMBO_FRAME;
+    }
+    // Frames above the data room of an mbuf are received and sent as chains
+    if (max_frame > conf->mbuf_size - RTE_PKTMBUF_HEADROOM) {
+        if (!(dev_info.rx_offload_capa & DEV_RX_OFFLOAD_SCATTER) || !(dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MULTI_SEGS)) {
+            LOG_ERRO("Port %hu cannot chain mbufs, --mbuf-size must fit %u Bytes frames\n", port_id, max_frame);
+            return -1;
+        }
+        port_conf.rxmode.offloads |= DEV_RX_OFFLOAD_SCATTER;
+        port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
+    }
+    // RSS only once the flows are steered with it (--steer rss or the ports
+    // reject the rte_flow rules), otherwise unmatched traffic stays on queue 0
+    uint64_t rss_hf = dev_info.flow_type_rss_offloads & (ETH_RSS_IP | ETH_RSS_TCP | ETH_RSS_UDP);
+    if (conf->steer == STEER_RSS && num_queue > 1 && rss_hf != 0 && dev_info.hash_key_size <= MAX_HASH_KEY_SIZE) {
+        for (int loop = 0; loop < dev_info.hash_key_size; loop++)
+            rss_key[loop] = conf->rss_key[loop % RSS_KEY_LEN];
+        port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_key     = (dev_info.hash_key_size > 0) ? rss_key : NULL;
+        port_conf.rx_adv_conf.rss_conf.rss_key_len = dev_info.hash_key_size;
+        port_conf.rx_adv_conf.rss_conf.rss_hf      = rss_hf;
+        rss_enabled[index] = true;
+    }
     if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE) {
         port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MBUF_FAST_FREE;
     } else {
         LOG_WARN("Device does not support DEV_TX_OFFLOAD_MBUF_FAST_FREE\n");
     }
+    // Tagging and the IPv4 checksums of tunnelled frames go to the port when
+    // it can, the threads do them in software otherwise
+    if (conf->vlan_id > 0) {
+        port_conf.rxmode.offloads |= dev_info.rx_offload_capa & DEV_RX_OFFLOAD_VLAN_STRIP;
+        port_conf.txmode.offloads |= dev_info.tx_offload_capa & DEV_TX_OFFLOAD_VLAN_INSERT;
+    }
+    if (conf->encap != ENCAP_NONE)
+        port_conf.txmode.offloads |= dev_info.tx_offload_capa & (DEV_TX_OFFLOAD_OUTER_IPV4_CKSUM | DEV_TX_OFFLOAD_IPV4_CKSUM);
+    uint64_t tx = port_conf.txmode.offloads;
+    if (conf->vlan_id > 0)
+        LOG_INFO("Port %hu VLAN %hu: strip in %s, insert in %s\n", port_id, conf->vlan_id,
+            (port_conf.rxmode.offloads & DEV_RX_OFFLOAD_VLAN_STRIP) ? "hw" : "sw", (tx & DEV_TX_OFFLOAD_VLAN_INSERT) ? "hw" : "sw");
+    if (conf->encap != ENCAP_NONE)
+        LOG_INFO("Port %hu tunnel checksums: outer IPv4 in %s, inner IPv4 %s\n", port_id,
+            (tx & (DEV_TX_OFFLOAD_OUTER_IPV4_CKSUM | DEV_TX_OFFLOAD_IPV4_CKSUM)) ? "hw" : "sw",
+            ((tx & DEV_TX_OFFLOAD_OUTER_IPV4_CKSUM) && (tx & DEV_TX_OFFLOAD_IPV4_CKSUM)) ? "in hw" : "left unset");
 
     ret = rte_eth_dev_configure(port_id, num_queue, num_queue, &port_conf);
     if (ret != 0) {
@@ -113,23 +240,24 @@ init_port(void) {
     } else {
         LOG_INFO("Configuring Port %hu: %hu receive queues and %hu transmit queues will be set up\n", port_id, num_queue, num_queue);
     }
+    if (max_frame > RTE_ETHER_MAX_LEN) {
+        // Some PMDs take the MTU rather than max_rx_pkt_len
+        ret = rte_eth_dev_set_mtu(port_id, max_frame - RTE_ETHER_HDR_LEN - RTE_ETHER_CRC_LEN);
+        if (ret != 0)
+            LOG_WARN("Cannot set the MTU of port %hu to %u\n", port_id, max_frame - RTE_ETHER_HDR_LEN - RTE_ETHER_CRC_LEN);
+        LOG_INFO("Jumbo frames of up to %u Bytes, %hu Bytes mbufs%s\n", max_frame, conf->mbuf_size,
+            (port_conf.rxmode.offloads & DEV_RX_OFFLOAD_SCATTER) ? " (chained)" : "");
+    }
 
-    struct rte_eth_txconf txq_conf = dev_info.default_txconf;
-    struct rte_eth_rxconf rxq_conf = dev_info.default_rxconf;;
-    txq_conf.offloads = port_conf.txmode.offloads;
-    rxq_conf.offloads = port_conf.rxmode.offloads;
-
-    uint16_t q_start = 0;
-    for (uint16_t q_id = q_start; q_id < num_queue; q_id++) {
-        struct conn_t conn = conn_arr[q_id];
-        ret = rte_eth_rx_queue_setup(port_id, conn.queue_id, SIZE_RING_RX, rte_eth_dev_socket_id(port_id), &rxq_conf, conn.mbuf_pool);
-        if (ret < 0)
-            return ret;
-        ret = rte_eth_tx_queue_setup(port_id, conn.queue_id, SIZE_RING_TX, rte_eth_dev_socket_id(port_id), &txq_conf);
-        if (ret < 0)
-            return ret;
-        LOG_INFO("  -- set up "CO_RED"rx %hu"CO_RESET" (%d receive descs) and "CO_YELLOW"tx %hu"CO_RESET" (%d transmit descs)\n", conn.queue_id, SIZE_RING_RX, conn.queue_id, SIZE_RING_TX);
+    rx_offloads[index] = port_conf.rxmode.offloads;
+    tx_offloads[index] = port_conf.txmode.offloads;
+    for (uint16_t loop = 0; loop < conf->total_lcore; loop++) {
+        if (conf->conn[loop].port_index == index)
+            conf->conn[loop].tx_offloads = tx_offloads[index];
     }
+    ret = setup_queues(index);
+    if (ret < 0)
+        return ret;
     ret = rte_eth_promiscuous_enable(port_id);
     if (ret == 0) {
         LOG_INFO("Enable receipt in promiscuous mode for Port %hu\n", port_id);
@@ -141,12 +269,155 @@ init_port(void) {
     } else {
         LOG_INFO("Start port %hu successfully!\n", port_id);
     }
-    assert_link_status(port_id);
+    return 0;
+}
+
+int
+init_vdev(void) {
+    struct conf_t* conf = get_conf();
+    if (conf->is_ring_pair == true) {
+        // Queue i of one end transmits into the ring queue i of the other end receives from
+        uint16_t num_queue = conf->num_thread + 1;
+        struct rte_ring* rings[2][MAX_LCORE];
+        for (uint16_t side = 0; side < 2; side++) {
+            for (uint16_t loop = 0; loop < num_queue; loop++) {
+                char name[RTE_RING_NAMESIZE];
+                snprintf(name, sizeof(name), "LOOPBACK_%hu_%hu", side, loop);
+                rings[side][loop] = rte_ring_create(name, rte_align32pow2(conf->ring_rx), rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+                if (rings[side][loop] == NULL) {
+                    LOG_ERRO("Cannot create ring %s\n", name);
+                    return -1;
+                }
+            }
+        }
+        for (uint16_t side = 0; side < 2; side++) {
+            char name[RTE_ETH_NAME_MAX_LEN];
+            snprintf(name, sizeof(name), "net_ring_loopback%hu", side);
+            int ret = rte_eth_from_rings(name, rings[side], num_queue, rings[1 - side], num_queue, rte_socket_id());
+            if (ret < 0) {
+                LOG_ERRO("Cannot create the ring port %s\n", name);
+                return -1;
+            }
+            conf->ports[side] = ret;
+        }
+        LOG_INFO("Loopback over a ring pair: Port %hu (client) <-> Port %hu (server), %hu queues\n", conf->ports[0], conf->ports[1], num_queue);
+        return 0;
+    }
+
+    for (uint16_t loop = 0; loop < conf->num_port; loop++) {
+        // EAL names the port after the device, up to the arguments
+        char name[LEN_PATH] = {0};
+        strncpy(name, conf->vdev[loop], strcspn(conf->vdev[loop], ","));
+        if (rte_eth_dev_get_port_by_name(name, &conf->ports[loop]) != 0) {
+            LOG_ERRO("Cannot find the port of --vdev %s\n", conf->vdev[loop]);
+            return -1;
+        }
+        LOG_INFO("Port %hu is the virtual device %s\n", conf->ports[loop], name);
+    }
+    if (conf->is_loopback == true)
+        LOG_INFO("Loopback over memif: Port %hu (client) <-> Port %hu (server)\n", conf->ports[0], conf->ports[1]);
+    return 0;
+}
+
+int
+init_port(void) {
+    struct conf_t* conf = get_conf();
+    for (uint16_t loop = 0; loop < conf->num_port; loop++) {
+        int ret = _init_port(loop);
+        if (ret != 0)
+            return ret;
+    }
+    // Links are checked once all ports are started, the two ends of
+    // --loopback over memif only come up together
+    for (uint16_t loop = 0; loop < conf->num_port; loop++) {
+        assert_link_status(conf->ports[loop]);
+        print_dev_conf(loop, conf->num_queue[loop]);
+    }
+    return 0;
+}
+
+int
+port_reconfigure(void) {
+    struct conf_t* conf = get_conf();
+    static uint32_t generation = 0;
+    generation++;
+
+    for (uint16_t loop = 0; loop < conf->num_port; loop++) {
+        int ret = rte_eth_dev_stop(conf->ports[loop]);
+        if (ret != 0) {
+            LOG_ERRO("Failed to stop port %hu\n", conf->ports[loop]);
+            return ret;
+        }
+    }
+
+    // The queues hold no mbuf once stopped, the old pools go after the queues
+    // are set up on the new ones
+    struct rte_mempool* old_pool[MAX_LCORE];
+    for (uint16_t loop = 0; loop < conf->total_lcore; loop++) {
+        struct conn_t* conn = &conf->conn[loop];
+        old_pool[loop] = conn->mbuf_pool;
+        if (conn->mbuf_pool->size == conf->pool_size && conn->mbuf_pool->cache_size == conf->pool_cache) {
+            old_pool[loop] = NULL;
+            continue;
+        }
+        char mbuf_pool_name[RTE_MEMPOOL_NAMESIZE];
+        snprintf(mbuf_pool_name, sizeof(mbuf_pool_name), "MBUF_POOL_%hu_%u", loop, generation);
+        conn->mbuf_pool = port_pool_create(mbuf_pool_name, conn->port_index);
+        if (conn->mbuf_pool == NULL) {
+            LOG_ERRO("Cannot create mbuf pool %s\n", mbuf_pool_name);
+            return -1;
+        }
+    }
+
+    for (uint16_t loop = 0; loop < conf->num_port; loop++) {
+        uint16_t port_id = conf->ports[loop];
+        LOG_INFO("Reconfiguring Port %hu ...\n", port_id);
+        int ret = setup_queues(loop);
+        if (ret < 0) {
+            LOG_ERRO("Failed to set up the queues of port %hu\n", port_id);
+            return ret;
+        }
+        ret = rte_eth_dev_start(port_id);
+        if (ret < 0) {
+            LOG_ERRO("Failed to start port %hu\n", port_id);
+            return ret;
+        }
+    }
+    for (uint16_t loop = 0; loop < conf->num_port; loop++)
+        assert_link_status(conf->ports[loop]);
 
-    print_dev_conf(port_id);
+    for (uint16_t loop = 0; loop < conf->total_lcore; loop++)
+        rte_mempool_free(old_pool[loop]);
     return 0;
 }
 
+struct rte_mempool*
+port_pool_create(const char* name, uint16_t port_index) {
+    struct conf_t* conf = get_conf();
+    uint16_t port_id = conf->ports[port_index];
+    // The port DMAs into the pool, keep both on its node
+    int socket_id = rte_eth_dev_socket_id(port_id);
+    if (socket_id < 0)
+        socket_id = rte_socket_id();
+    struct rte_eth_dev_info dev_info;
+    rte_eth_dev_info_get(port_id, &dev_info);
+    uint32_t data_room = RTE_MAX((uint32_t) conf->mbuf_size, RTE_PKTMBUF_HEADROOM + dev_info.min_rx_bufsize);
+    return rte_pktmbuf_pool_create(name, conf->pool_size, conf->pool_cache, 0, (uint16_t) data_room, socket_id);
+}
+
+uint32_t
+port_link_speed(void) {
+    struct conf_t* conf = get_conf();
+    uint32_t speed = 0;
+    for (uint16_t loop = 0; loop < conf->num_port; loop++) {
+        struct rte_eth_link link;
+        memset(&link, 0, sizeof(link));
+        rte_eth_link_get_nowait(conf->ports[loop], &link);
+        speed += link.link_speed;
+    }
+    return speed;
+}
+
 static inline int
 convert_mask_to_depth(uint32_t mask) {
     int ret = 0;
@@ -200,9 +471,10 @@ add_rule(uint16_t port_id, struct rte_flow_attr* attr, struct rte_flow_item patt
     }
 }
 
-#define MAX_PATTERN_NUM 4
-static inline void
-_init_flow(int index, uint16_t port_id,  uint32_t dst_ip, uint32_t mask_ip, uint16_t dst_port, uint16_t mask_port, uint16_t dst_queue) {
+// ETH, VLAN, IPV4, GRE, GRE_KEY, END
+#define MAX_PATTERN_NUM 6
+static inline int
+_init_flow(int index, uint16_t port_id,  uint32_t dst_ip, uint32_t mask_ip, uint16_t dst_port, uint16_t mask_port, uint16_t dst_queue, bool dry) {
     /* properties of a flow rule such as its direction (ingress or egress) and priority */
     struct rte_flow_attr attr;
     /* part of a matching pattern that either matches specific packet data or traffic properties.
@@ -217,6 +489,13 @@ _init_flow(int index, uint16_t port_id,  uint32_t dst_ip, uint32_t mask_ip, uint
     struct rte_flow_item_udp  udp_mask;
     struct rte_flow_item_tcp  tcp_spec;
     struct rte_flow_item_tcp  tcp_mask;
+    struct rte_flow_item_vlan vlan_spec;
+    struct rte_flow_item_vlan vlan_mask;
+    rte_be32_t                key_spec;
+    rte_be32_t                key_mask;
+    uint16_t                  num = 0;
+    const char*               proto = "TCP";
+    struct conf_t* conf = get_conf();
     /* traffic properties to look for, a combination of any number of items. */
     struct rte_flow_item pattern[MAX_PATTERN_NUM];
     /* operations to perform whenever a packet is matched by a pattern. */
@@ -238,18 +517,29 @@ _init_flow(int index, uint16_t port_id,  uint32_t dst_ip, uint32_t mask_ip, uint
     /* skip ehternet header */
     memset(&eth_spec, 0, sizeof(struct rte_flow_item_eth));
     memset(&eth_mask, 0, sizeof(struct rte_flow_item_eth));
-    pattern[0].type = RTE_FLOW_ITEM_TYPE_ETH;
-    pattern[0].spec = &eth_spec;
-    pattern[0].mask = &eth_mask;
+    pattern[num].type = RTE_FLOW_ITEM_TYPE_ETH;
+    pattern[num].spec = &eth_spec;
+    pattern[num++].mask = &eth_mask;
+
+    /* match the VLAN of --vlan, the port may strip the tag after matching */
+    if (conf->vlan_id > 0) {
+        memset(&vlan_spec, 0, sizeof(struct rte_flow_item_vlan));
+        memset(&vlan_mask, 0, sizeof(struct rte_flow_item_vlan));
+        vlan_spec.tci = htons(conf->vlan_id);
+        vlan_mask.tci = htons(0x0fff);
+        pattern[num].type = RTE_FLOW_ITEM_TYPE_VLAN;
+        pattern[num].spec = &vlan_spec;
+        pattern[num++].mask = &vlan_mask;
+    }
 
     /* skip ip header */
     memset(&ip_spec, 0, sizeof(struct rte_flow_item_ipv4));
     memset(&ip_mask, 0, sizeof(struct rte_flow_item_ipv4));
     ip_spec.hdr.dst_addr = dst_ip;
     ip_mask.hdr.dst_addr = mask_ip;
-    pattern[1].type = RTE_FLOW_ITEM_TYPE_IPV4;
-    pattern[1].spec = &ip_spec;
-    pattern[1].mask = &ip_mask;
+    pattern[num].type = RTE_FLOW_ITEM_TYPE_IPV4;
+    pattern[num].spec = &ip_spec;
+    pattern[num++].mask = &ip_mask;
 
     // pattern[2].type = RTE_FLOW_ITEM_TYPE_END;
     // add_rule(port_id, &attr, pattern, action);
@@ -280,40 +570,217 @@ _init_flow(int index, uint16_t port_id,  uint32_t dst_ip, uint32_t mask_ip, uint
     add_rule(port_id, &attr, pattern, action);
     */
 
-    /* match tcp destination port */
-    memset(&tcp_spec, 0, sizeof(struct rte_flow_item_tcp));
-    memset(&tcp_mask, 0, sizeof(struct rte_flow_item_tcp));
-    tcp_spec.hdr.dst_port = dst_port;
-    tcp_mask.hdr.dst_port = mask_port;
-    pattern[2].type = RTE_FLOW_ITEM_TYPE_TCP;
-    pattern[2].spec = &tcp_spec;
-    pattern[2].mask = &tcp_mask;
+    memset(&udp_spec, 0, sizeof(struct rte_flow_item_udp));
+    memset(&udp_mask, 0, sizeof(struct rte_flow_item_udp));
+    if (conf->encap == ENCAP_VXLAN) {
+        /* match the outer udp source port, the tunnel echoes it back */
+        udp_spec.hdr.src_port = dst_port;
+        udp_mask.hdr.src_port = mask_port;
+        pattern[num].type = RTE_FLOW_ITEM_TYPE_UDP;
+        pattern[num].spec = &udp_spec;
+        pattern[num++].mask = &udp_mask;
+        proto = "VXLAN";
+    } else if (conf->encap == ENCAP_GRE) {
+        /* match the gre key */
+        key_spec = htonl(ntohs(dst_port));
+        key_mask = htonl(ntohs(mask_port));
+        pattern[num++].type = RTE_FLOW_ITEM_TYPE_GRE;
+        pattern[num].type = RTE_FLOW_ITEM_TYPE_GRE_KEY;
+        pattern[num].spec = &key_spec;
+        pattern[num++].mask = &key_mask;
+        proto = "GRE";
+    } else {
+        /* match tcp destination port */
+        memset(&tcp_spec, 0, sizeof(struct rte_flow_item_tcp));
+        memset(&tcp_mask, 0, sizeof(struct rte_flow_item_tcp));
+        tcp_spec.hdr.dst_port = dst_port;
+        tcp_mask.hdr.dst_port = mask_port;
+        pattern[num].type = RTE_FLOW_ITEM_TYPE_TCP;
+        pattern[num].spec = &tcp_spec;
+        pattern[num++].mask = &tcp_mask;
+    }
 
-    pattern[3].type = RTE_FLOW_ITEM_TYPE_END;
+    pattern[num].type = RTE_FLOW_ITEM_TYPE_END;
+    if (dry == true) {
+        struct rte_flow_error error;
+        return rte_flow_validate(port_id, &attr, pattern, action, &error);
+    }
     add_rule(port_id, &attr, pattern, action);
 
     struct in_addr ip_src = { .s_addr = ip_spec.hdr.src_addr };
     struct in_addr ip_dst = { .s_addr = ip_spec.hdr.dst_addr };
-    LOG_INFO("  %02d:  %s/%d  %s/%d  0x%04x/0x%04x  0x%04x/0x%04x  TCP/UDP "CO_YELLOW"→"CO_RESET"  %2hu\n",
+    // VXLAN and GRE flows are told apart by the outer source port or the key
+    bool is_tnl = (conf->encap != ENCAP_NONE);
+    LOG_INFO("  %02d:  %s/%d  %s/%d  0x%04x/0x%04x  0x%04x/0x%04x  %-5s "CO_YELLOW"→"CO_RESET"  %2hu\n",
         index + 1,
         inet_ntoa(ip_src), convert_mask_to_depth(ip_mask.hdr.src_addr),
         inet_ntoa(ip_dst), convert_mask_to_depth(ip_mask.hdr.dst_addr),
-        ntohs(udp_spec.hdr.src_port), ntohs(udp_mask.hdr.src_port),
-        ntohs(dst_port), ntohs(mask_port),
-        dst_queue
+        is_tnl ? ntohs(dst_port) : 0, is_tnl ? ntohs(mask_port) : 0,
+        is_tnl ? 0 : ntohs(dst_port), is_tnl ? 0 : ntohs(mask_port),
+        proto, dst_queue
     );
+    return 0;
+}
+
+/**
+ * Toeplitz hash of a thread's flow as received, addresses and ports in
+ * network order
+ */
+static inline uint32_t
+rss_hash(uint32_t src_addr, uint32_t dst_addr, uint16_t src_port, uint16_t dst_port) {
+    struct conf_t* conf = get_conf();
+    uint32_t tuple[3];
+    tuple[0] = ntohl(src_addr);
+    tuple[1] = ntohl(dst_addr);
+    tuple[2] = ((uint32_t) ntohs(src_port) << 16) | ntohs(dst_port);
+    return rte_softrss(tuple, 3, conf->rss_key);
+}
+
+/**
+ * Spread the RETA over the worker queues (queue 0 belongs to the main lcore,
+ * which does not poll). The client then picks for each thread a source port
+ * whose flow hashes to an entry of the thread's own queue. The key is
+ * symmetric by default, so the server, with the same RETA, receives the flow
+ * on the same queue and the replies come back to the right client thread.
+ */
+static void
+init_rss(uint16_t port_index) {
+    struct conf_t* conf = get_conf();
+    uint16_t port_id = conf->ports[port_index];
+    uint16_t num_worker = RTE_MAX(conf->num_queue[port_index] - 1, 1);
+
+    struct rte_eth_dev_info dev_info;
+    rte_eth_dev_info_get(port_id, &dev_info);
+    // Frames would stay on queue 0, which the main lcore never polls
+    if (rss_enabled[port_index] == false) {
+        LOG_ERRO("Port %hu supports neither the rte_flow rules nor RSS on IP/TCP/UDP\n", port_id);
+        exit(-1);
+    }
+    // Ports hash GRE on the outer addresses only, all threads would share a queue
+    if (conf->encap == ENCAP_GRE && num_worker > 1) {
+        LOG_ERRO("Port %hu cannot spread GRE flows with RSS, run -P 1 or steer them with rte_flow\n", port_id);
+        exit(-1);
+    }
+    uint16_t reta_size = dev_info.reta_size;
+    if (reta_size == 0 || reta_size > MAX_RETA_SIZE) {
+        LOG_ERRO("Port %hu has a RETA of %hu entries, cannot steer flows with RSS\n", port_id, reta_size);
+        exit(-1);
+    }
+
+    struct rte_eth_rss_reta_entry64 reta[MAX_RETA_SIZE / RTE_RETA_GROUP_SIZE];
+    memset(reta, 0, sizeof(reta));
+    for (uint16_t loop = 0; loop < reta_size; loop++) {
+        reta[loop / RTE_RETA_GROUP_SIZE].mask |= 1ULL << (loop % RTE_RETA_GROUP_SIZE);
+        reta[loop / RTE_RETA_GROUP_SIZE].reta[loop % RTE_RETA_GROUP_SIZE] = 1 + loop % num_worker;
+    }
+    if (rte_eth_dev_rss_reta_update(port_id, reta, reta_size) != 0) {
+        LOG_ERRO("Cannot update the RETA of port %hu\n", port_id);
+        exit(-1);
+    }
+
+    // Self-check against what the port actually holds
+    memset(reta, 0, sizeof(reta));
+    for (uint16_t loop = 0; loop < reta_size; loop += RTE_RETA_GROUP_SIZE)
+        reta[loop / RTE_RETA_GROUP_SIZE].mask = UINT64_MAX;
+    if (rte_eth_dev_rss_reta_query(port_id, reta, reta_size) != 0) {
+        LOG_ERRO("Cannot query the RETA of port %hu\n", port_id);
+        exit(-1);
+    }
+    uint32_t entries[MAX_LCORE] = {0};
+    for (uint16_t loop = 0; loop < reta_size; loop++) {
+        uint16_t queue = reta[loop / RTE_RETA_GROUP_SIZE].reta[loop % RTE_RETA_GROUP_SIZE];
+        if (queue < MAX_LCORE)
+            entries[queue]++;
+    }
+
+    LOG_INFO("Populating RSS of port %hu (RETA of %hu entries over queues 1-%hu) ...\n", port_id, reta_size, num_worker);
+    LOG_LINE(75, '-', "RSS (ingress)");
+    uint16_t hit = 0;
+    if (conf->is_client == true) {
+        LOG_INFO("Thread  S_Port  D_Port  Hash        RETA  Queue  Entries\n");
+        for (uint16_t loop = 1; loop < conf->total_lcore; loop++) {
+            struct conn_t* conn = &conf->conn[loop];
+            if (conn->port_index != port_index)
+                continue;
+            // Replies arrive from the server's port to ours. Over VXLAN the
+            // port hashes the outer header, whose source port (ours) is echoed
+            // and whose destination is the VXLAN port.
+            uint32_t port = conf->port_base + MAX_LCORE;
+            for (; port <= UINT16_MAX; port++) {
+                uint32_t hash = (conf->encap == ENCAP_VXLAN) ?
+                    rss_hash(conn->dst_addr, conn->src_addr, htons(port), htons(RTE_VXLAN_DEFAULT_PORT)) :
+                    rss_hash(conn->dst_addr, conn->src_addr, conn->dst_port, htons(port));
+                if (reta[(hash % reta_size) / RTE_RETA_GROUP_SIZE].reta[(hash % reta_size) % RTE_RETA_GROUP_SIZE] == conn->queue_id)
+                    break;
+            }
+            if (port <= UINT16_MAX)
+                conn->src_port = htons(port);
+            uint32_t hash  = (conf->encap == ENCAP_VXLAN) ?
+                rss_hash(conn->dst_addr, conn->src_addr, conn->src_port, htons(RTE_VXLAN_DEFAULT_PORT)) :
+                rss_hash(conn->dst_addr, conn->src_addr, conn->dst_port, conn->src_port);
+            uint16_t index = hash % reta_size;
+            uint16_t queue = reta[index / RTE_RETA_GROUP_SIZE].reta[index % RTE_RETA_GROUP_SIZE];
+            if (queue == conn->queue_id)
+                hit++;
+            LOG_INFO("  %02hu    %5hu   %5hu   0x%08x  %4hu  %5hu  %7u\n",
+                loop, ntohs(conn->src_port), ntohs(conn->dst_port), hash, index, queue, queue < MAX_LCORE ? entries[queue] : 0);
+        }
+    } else {
+        // The peer is unknown, report how the RETA spreads over the queues
+        LOG_INFO("Queue  Entries  Share\n");
+        for (uint16_t loop = 0; loop < conf->num_queue[port_index]; loop++) {
+            if (entries[loop] > 0)
+                hit++;
+            LOG_INFO("  %02hu   %7u  %5.1f%%\n", loop, entries[loop], entries[loop] * 100.0 / reta_size);
+        }
+    }
+    LOG_LINE(75, '-', NULL);
+    if (conf->is_client == true && hit < num_worker)
+        LOG_WARN("Only %hu of %hu threads receive on their own queue\n", hit, num_worker);
+    else if (conf->is_server == true && hit < num_worker)
+        LOG_WARN("The RETA covers only %hu of %hu worker queues\n", hit, num_worker);
+    else
+        LOG_INFO("Every worker queue is covered by the RETA%s\n", conf->is_client == true ? " and receives its thread's flow" : "");
+    if (conf->is_server == true)
+        LOG_INFO("Clients must run with --steer rss (or fall back to it) and the same -P\n");
 }
 
 void 
 init_flow(void) {
     struct conf_t* conf = get_conf();
 
+    // Ring pairs and most virtual devices have neither rte_flow nor RSS, their
+    // queues are wired to the peer's queues already
+    if (conf->num_vdev > 0 || conf->is_loopback == true)
+        return;
+
+    for (uint16_t loop = 0; loop < conf->num_port && conf->steer == STEER_AUTO; loop++) {
+        if (_init_flow(0, conf->ports[loop], htonl(0), htonl(0), conf->conn[0].src_port, htons(0xffff), 0, true) != 0) {
+            LOG_WARN("Port %hu rejects the rte_flow rules, steer flows with RSS instead\n", conf->ports[loop]);
+            conf->steer = STEER_RSS;
+            // RSS is enabled at configure time, start the ports over with it
+            for (uint16_t index = 0; index < conf->num_port; index++) {
+                if (rte_eth_dev_stop(conf->ports[index]) != 0 || _init_port(index) != 0) {
+                    LOG_ERRO("Cannot reconfigure port %hu with RSS\n", conf->ports[index]);
+                    exit(-1);
+                }
+            }
+            for (uint16_t index = 0; index < conf->num_port; index++)
+                assert_link_status(conf->ports[index]);
+        }
+    }
+    if (conf->steer == STEER_RSS) {
+        for (uint16_t loop = 0; loop < conf->num_port; loop++)
+            init_rss(loop);
+        return;
+    }
+
     LOG_INFO("Populating Flow Director rules ...\n");
     LOG_LINE(75, '-', "FlowDirector (ingress)");
     LOG_INFO("Index  S_IP/Mask  D_IP/Mask   S_Port/Mask    D_Port/Mask    Proto    Queue\n");
     int loop_start = 0;
     for (int loop = loop_start; loop < conf->total_lcore; loop++) {
-        _init_flow(loop, conf->conn[loop].port_id, htonl(0), htonl(0), conf->conn[loop].src_port, htons(0xffff), conf->conn[loop].queue_id);
+        _init_flow(loop, conf->conn[loop].port_id, htonl(0), htonl(0), conf->conn[loop].src_port, htons(0xffff), conf->conn[loop].queue_id, false);
     }
     LOG_LINE(75, '-', NULL);
 }
\ No newline at end of file
@@ -4,7 +4,16 @@
 #include "conf.h"
 
 /**
- * Configure and start the port
+ * Find the ports of --vdev, or create the ring pair of --loopback
+ *
+ * @return
+ *   - 0: Success
+ *   - -1: Otherwise
+ */
+int init_vdev(void);
+
+/**
+ * Configure and start every port with the queues of its threads
  * 
  * @return
  *   - 0: Success
@@ -13,8 +22,42 @@
 int init_port(void);
 
 /**
- * Initilize the Flow Director
+ * Initilize the Flow Director, or RSS steering if the port rejects the
+ * rte_flow rules (--steer auto) or --steer rss is given
  */
 void init_flow(void);
 
+/**
+ * Stop the ports and set up their queues again with the descriptors and mbuf
+ * pool parameters of the global configuration, between the trials of --sweep.
+ * The device configuration, flow rules and RETA are kept.
+ *
+ * @return
+ *   - 0: Success
+ *   - <0: Otherwise
+ */
+int port_reconfigure(void);
+
+/**
+ * Create an mbuf pool of the configured size for a thread of a port, on the
+ * NUMA node of the port. The data room fits conf->frame_size and the smallest
+ * RX buffer of the port.
+ *
+ * @para name
+ *   Name of the pool
+ * @para port_index
+ *   Index of the port in conf->ports
+ * @return
+ *   The pool, NULL on error
+ */
+struct rte_mempool* port_pool_create(const char* name, uint16_t port_index);
+
+/**
+ * Aggregate link speed of all ports
+ *
+ * @return
+ *   Sum of the link speeds (Mbps), 0 if none is known
+ */
+uint32_t port_link_speed(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <rte_common.h>
+
+#include "util.h"
+#include "conf.h"
+#include "result.h"
+
+struct interval_t {
+    double t;
+    double rx_gbps;
+    double tx_gbps;
+    double rx_mpps;
+    double tx_mpps;
+    double goodput;
+};
+
+static const char* res_name[NUM_RES] = {
+    "rx_gbps", "tx_gbps", "rx_mpps", "tx_mpps", "goodput_gbps", "tps",
+    "p50_ns", "p90_ns", "p99_ns", "p999_ns", "cpu_pct", "mem_kb", "ipc", "cyc_per_pkt"
+};
+// Whether a larger value is better, tells a regression from an improvement
+static const bool res_higher[NUM_RES] = {
+    true, true, true, true, true, true,
+    false, false, false, false, false, false, true, false
+};
+
+double res_value[NUM_RES] = { [0 ... NUM_RES-1] = NAN };
+struct interval_t intervals[MAX_INTERVALS];
+uint32_t num_interval = 0;
+const uint64_t* res_hist = NULL;
+
+void
+result_set(int metric, double value) {
+    if (metric >= 0 && metric < NUM_RES)
+        res_value[metric] = value;
+}
+
+void
+result_set_latency(double perc, double ns) {
+    if (fabs(perc - 50.0) < 1e-6)
+        res_value[RES_P50]  = ns;
+    else if (fabs(perc - 90.0) < 1e-6)
+        res_value[RES_P90]  = ns;
+    else if (fabs(perc - 99.0) < 1e-6)
+        res_value[RES_P99]  = ns;
+    else if (fabs(perc - 99.9) < 1e-6)
+        res_value[RES_P999] = ns;
+}
+
+void
+result_set_hist(const uint64_t* hist) {
+    res_hist = hist;
+}
+
+void
+result_add_interval(double t, double rx_gbps, double tx_gbps, double rx_mpps, double tx_mpps, double goodput) {
+    if (num_interval >= MAX_INTERVALS)
+        return;
+    struct interval_t* iv = &intervals[num_interval++];
+    iv->t       = t;
+    iv->rx_gbps = rx_gbps;
+    iv->tx_gbps = tx_gbps;
+    iv->rx_mpps = rx_mpps;
+    iv->tx_mpps = tx_mpps;
+    iv->goodput = goodput;
+}
+
+void
+result_save(struct conf_t* conf) {
+    FILE* fp = fopen(conf->result_path, "a");
+    if (fp == NULL) {
+        LOG_WARN("Cannot open %s, the results of this run are not saved\n", conf->result_path);
+        return;
+    }
+
+    // Mean goodput over the intervals unless a mode reported its own
+    if (isnan(res_value[RES_GOODPUT]) && num_interval > 0) {
+        double sum = 0;
+        for (uint32_t loop = 0; loop < num_interval; loop++)
+            sum += intervals[loop].goodput;
+        res_value[RES_GOODPUT] = sum / num_interval;
+    }
+
+    const char* mode = conf->is_rtt ? "rtt" : conf->is_rr ? "rr" : conf->is_fct ? "fct" : conf->is_pps ? "mpps" :
+                       conf->is_file ? "file" : conf->is_udp ? "udp" : "tcp";
+    fprintf(fp, "{\"tag\":\"%s\",\"time\":%ld,\"role\":\"%s\",\"mode\":\"%s\"",
+        conf->result_tag, (long) time(NULL), conf->is_client ? "client" : "server", mode);
+    fprintf(fp, ",\"threads\":%hu,\"ports\":%hu,\"pkt_size\":%hu,\"win_size\":%hu,\"bufsize\":%lu,\"data_size\":%lu,\"duration\":%.3f",
+        conf->num_thread, conf->num_port, conf->pkt_size, conf->win_size, conf->bufsize, conf->data_size, time_double(conf->all_time));
+    if (conf->is_rr == true)
+        fprintf(fp, ",\"rr_req\":%hu,\"rr_resp\":%hu,\"rr_inflight\":%hu", conf->rr_req, conf->rr_resp, conf->rr_inflight);
+    if (conf->encap_len > 0)
+        fprintf(fp, ",\"encap\":\"%s\",\"vlan\":%hu", conf->encap == ENCAP_VXLAN ? "vxlan" : conf->encap == ENCAP_GRE ? "gre" : "none", conf->vlan_id);
+
+    for (int loop = 0; loop < NUM_RES; loop++) {
+        if (!isnan(res_value[loop]))
+            fprintf(fp, ",\"%s\":%.6g", res_name[loop], res_value[loop]);
+    }
+
+    // [t, rx Gbps, tx Gbps, rx Mpps, tx Mpps, goodput Gbps]
+    fprintf(fp, ",\"intervals\":[");
+    for (uint32_t loop = 0; loop < num_interval; loop++) {
+        struct interval_t* iv = &intervals[loop];
+        fprintf(fp, "%s[%.2f,%.4f,%.4f,%.4f,%.4f,%.4f]", loop > 0 ? "," : "",
+            iv->t, iv->rx_gbps, iv->tx_gbps, iv->rx_mpps, iv->tx_mpps, iv->goodput);
+    }
+    fprintf(fp, "]");
+
+    // Non-empty buckets only, [upper bound (ns), count]
+    if (res_hist != NULL) {
+        bool first = true;
+        fprintf(fp, ",\"latency_hist\":[");
+        for (uint32_t loop = 0; loop < HIST_SIZE; loop++) {
+            if (res_hist[loop] == 0)
+                continue;
+            fprintf(fp, "%s[%lu,%lu]", first ? "" : ",", hz_to_ns(hist_value(loop)), res_hist[loop]);
+            first = false;
+        }
+        fprintf(fp, "]");
+    }
+    fprintf(fp, "}\n");
+    fclose(fp);
+    LOG_INFO("Appended the results of this run to %s (tag \"%s\")\n", conf->result_path, conf->result_tag);
+}
+
+double
+result_get(int metric) {
+    if (metric < 0 || metric >= NUM_RES)
+        return NAN;
+    return res_value[metric];
+}
+
+void
+result_reset(void) {
+    for (int loop = 0; loop < NUM_RES; loop++)
+        res_value[loop] = NAN;
+    num_interval = 0;
+    res_hist = NULL;
+}
+
+/**
+ * Samples of a metric over the runs of one tag
+ */
+struct sample_t {
+    uint32_t n;
+    double sum;
+    double sum_sq;
+};
+
+/**
+ * Extract "tag" and the summary metrics from a record. Records are written by
+ * result_save(), so a flat key lookup is enough.
+ */
+static int
+parse_record(const char* line, char* tag, size_t tag_len, double* value) {
+    const char* pos = strstr(line, "\"tag\":\"");
+    if (pos == NULL)
+        return -1;
+    pos += strlen("\"tag\":\"");
+    const char* end = strchr(pos, '"');
+    if (end == NULL)
+        return -1;
+    snprintf(tag, tag_len, "%.*s", (int) (end - pos), pos);
+
+    char key[32];
+    for (int loop = 0; loop < NUM_RES; loop++) {
+        value[loop] = NAN;
+        snprintf(key, sizeof(key), "\"%s\":", res_name[loop]);
+        pos = strstr(line, key);
+        if (pos != NULL)
+            value[loop] = strtod(pos + strlen(key), NULL);
+    }
+    return 0;
+}
+
+/**
+ * Two-sided 95% critical value of Student's t distribution
+ */
+static double
+t_critical(double df) {
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    int idx = (int) floor(df);
+    if (idx < 1)
+        return table[0];
+    return (idx <= 30) ? table[idx-1] : 1.960;
+}
+
+int
+result_compare(const char* path, const char* spec) {
+    char base[LEN_PATH] = {0}, cand[LEN_PATH] = {0};
+    const char* comma = strchr(spec, ',');
+    if (comma == NULL) {
+        LOG_ERRO("--compare expects <base tag>,<candidate tag>\n");
+        return -1;
+    }
+    snprintf(base, sizeof(base), "%.*s", (int) (comma - spec), spec);
+    snprintf(cand, sizeof(cand), "%s", comma + 1);
+
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        LOG_ERRO("Cannot open %s\n", path);
+        return -1;
+    }
+    struct sample_t sample[2][NUM_RES];
+    memset(sample, 0, sizeof(sample));
+    uint32_t runs[2] = {0};
+
+    // Records carry per-interval rates and histograms, lines can be long
+    size_t cap = 0;
+    char* line = NULL;
+    char tag[LEN_PATH];
+    double value[NUM_RES];
+    while (getline(&line, &cap, fp) != -1) {
+        if (parse_record(line, tag, sizeof(tag), value) != 0)
+            continue;
+        int set = (strcmp(tag, base) == 0) ? 0 : (strcmp(tag, cand) == 0) ? 1 : -1;
+        if (set < 0)
+            continue;
+        runs[set]++;
+        for (int loop = 0; loop < NUM_RES; loop++) {
+            if (isnan(value[loop]))
+                continue;
+            sample[set][loop].n++;
+            sample[set][loop].sum    += value[loop];
+            sample[set][loop].sum_sq += value[loop] * value[loop];
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    if (runs[0] == 0 || runs[1] == 0) {
+        LOG_ERRO("No run tagged \"%s\" or \"%s\" in %s\n", runs[0] == 0 ? base : "", runs[1] == 0 ? cand : "", path);
+        return -1;
+    }
+
+    int regressions = 0;
+    LOG_LINE(100, '-', "Comparison");
+    LOG_INFO("Base \"%s\" (%u runs) vs candidate \"%s\" (%u runs), 95%% confidence\n", base, runs[0], cand, runs[1]);
+    LOG_INFO("Metric              Base mean    stdev   Cand mean    stdev     Delta   95%% CI of delta          Verdict\n");
+    for (int loop = 0; loop < NUM_RES; loop++) {
+        struct sample_t* a = &sample[0][loop];
+        struct sample_t* b = &sample[1][loop];
+        if (a->n == 0 || b->n == 0)
+            continue;
+        double mean_a = a->sum / a->n;
+        double mean_b = b->sum / b->n;
+        double var_a  = (a->n > 1) ? RTE_MAX((a->sum_sq - a->n * mean_a * mean_a) / (a->n - 1), 0.0) : 0;
+        double var_b  = (b->n > 1) ? RTE_MAX((b->sum_sq - b->n * mean_b * mean_b) / (b->n - 1), 0.0) : 0;
+        double diff   = mean_b - mean_a;
+
+        const char* verdict = "n/a (1 run)";
+        double half = NAN;
+        if (a->n > 1 && b->n > 1) {
+            // Welch's t-test, unequal variances
+            double se_a = var_a / a->n, se_b = var_b / b->n;
+            double se   = sqrt(se_a + se_b);
+            double df   = (se_a + se_b) * (se_a + se_b) /
+                          ((a->n > 1 ? se_a * se_a / (a->n - 1) : 0) + (b->n > 1 ? se_b * se_b / (b->n - 1) : 0) + 1e-300);
+            half = t_critical(df) * se;
+            if (fabs(diff) <= half) {
+                verdict = "~";
+            } else if ((diff > 0) == res_higher[loop]) {
+                verdict = "improved";
+            } else {
+                verdict = "REGRESSION";
+                regressions++;
+            }
+        }
+        char ci[48];
+        if (isnan(half))
+            snprintf(ci, sizeof(ci), "-");
+        else
+            snprintf(ci, sizeof(ci), "[%.4g, %.4g]", diff - half, diff + half);
+        LOG_INFO("%-16s %12.4g %8.3g %11.4g %8.3g  %+7.2f%%   %-22s  %s\n",
+            res_name[loop], mean_a, sqrt(var_a), mean_b, sqrt(var_b),
+            mean_a != 0 ? diff * 100 / fabs(mean_a) : 0, ci, verdict);
+    }
+    LOG_LINE(100, '-', NULL);
+    return (regressions > 0) ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+#ifndef _RESULT_H_
+#define _RESULT_H_
+
+#include <stdint.h>
+
+#include "conf.h"
+
+/**
+ * Default results file, one JSON record per run
+ */
+#define RESULT_PATH           "dperf_results.jsonl"
+/**
+ * Max number of per-interval samples kept in a record
+ */
+#define MAX_INTERVALS         3600
+
+/**
+ * Summary metrics of a run, compared across runs by --compare
+ */
+#define RES_RX_GBPS           0
+#define RES_TX_GBPS           1
+#define RES_RX_MPPS           2
+#define RES_TX_MPPS           3
+#define RES_GOODPUT           4     // Gbps
+#define RES_TPS               5     // Transactions/s (--rr)
+#define RES_P50               6     // Latency (ns), --rtt or --rr
+#define RES_P90               7
+#define RES_P99               8
+#define RES_P999              9
+#define RES_CPU               10    // Average CPU usage (%)
+#define RES_MEM               11    // Max RSS (KB)
+#define RES_IPC               12    // --pmu
+#define RES_CYC_PKT           13    // --pmu
+#define NUM_RES               14
+
+/**
+ * Record a summary metric of this run
+ *
+ * @para metric
+ *   RES_XX
+ * @para value
+ *   Value of the metric
+ */
+void result_set(int metric, double value);
+
+/**
+ * Record a latency percentile, only P50/P90/P99/P99.9 are kept
+ *
+ * @para perc
+ *   Percentile, e.g., 99.9
+ * @para ns
+ *   Latency (ns)
+ */
+void result_set_latency(double perc, double ns);
+
+/**
+ * Record the latency histogram of this run (HIST_SIZE buckets of cycles)
+ *
+ * @para hist
+ *   Histogram, see hist_index()
+ */
+void result_set_hist(const uint64_t* hist);
+
+/**
+ * Record the rates of one reporting interval
+ *
+ * @para t
+ *   End of the interval (seconds since start)
+ */
+void result_add_interval(double t, double rx_gbps, double tx_gbps, double rx_mpps, double tx_mpps, double goodput);
+
+/**
+ * Append the record of this run (configuration, summary metrics, intervals and
+ * latency histogram) to the results file
+ *
+ * @para conf
+ *   Global configuration
+ */
+void result_save(struct conf_t* conf);
+
+/**
+ * Get a summary metric of this run, after result_save() the mean goodput is
+ * filled in as well
+ *
+ * @para metric
+ *   RES_XX
+ * @return
+ *   Value of the metric, NAN if not recorded
+ */
+double result_get(int metric);
+
+/**
+ * Clear the metrics, intervals and histogram for the next run of a sweep
+ */
+void result_reset(void);
+
+/**
+ * Compare two sets of runs of the results file, grouped by --tag. For every
+ * metric, print mean, stdev and the 95% confidence interval of the difference
+ * (Welch's t-test) and flag significant regressions.
+ *
+ * @para path
+ *   Results file
+ * @para spec
+ *   "<base tag>,<candidate tag>"
+ * @return
+ *   - 0: No significant regression
+ *   - 1: At least one significant regression
+ *   - -1: Error
+ */
+int result_compare(const char* path, const char* spec);
+
+#endif
@@ -1,26 +1,95 @@
 #include <time.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <net/if.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <event2/event.h>
 
-#include <rte_timer.h>
 #include <rte_ethdev.h>
 
 #include "util.h"
 #include "stat.h"
 #include "conf.h"
+#include "core.h"
+#include "pmu.h"
+#include "result.h"
+#include "burst.h"
 
 struct event_base *ev_base = NULL;
 struct event *ev_eth = NULL;
-struct rte_timer timer;
-struct nstats ethstat;
-uint64_t prev_tsc = 0;
+struct nstats ethstat[MAX_PORT];
 uint64_t base_tsc = 0;
-struct stats tfs = {0};
+struct stats tfs = { .fd_pstat = -1, .fd_stat = -1, .fd_status = -1, .fd_cpumem = -1 };
+struct app_stat_t app_pre[MAX_LCORE];
+struct xstat_sel xsel[MAX_PORT];
+
+/**
+ * Extended statistics worth watching while the test runs: discards, buffer
+ * exhaustion and pause frames. Names differ across PMDs (mlx5, i40e/ice,
+ * ixgbe), the ones a port does not have are skipped.
+ */
+static const char* xstat_wanted[] = {
+    "rx_phy_discard_packets", "tx_phy_discard_packets", "rx_discards_phy", "tx_discards_phy",
+    "rx_out_of_buffer", "rx_missed_errors", "rx_mbuf_allocation_errors", "rx_discards", "tx_dropped",
+    "rx_pause_ctrl_phy", "tx_pause_ctrl_phy", "rx_xoff_packets", "tx_xoff_packets",
+};
+// Per-priority (PFC) counters, %d is the priority
+static const char* xstat_wanted_prio[] = {
+    "rx_prio%d_pause", "tx_prio%d_pause", "rx_prio%d_discards",
+    "rx_priority%d_xoff_packets", "tx_priority%d_xoff_packets",
+};
+
+static void
+xstat_add(struct xstat_sel* sel, uint16_t port_id, const char* name) {
+    uint64_t id;
+    if (sel->num >= MAX_XSTAT_SEL || rte_eth_xstats_get_id_by_name(port_id, name, &id) != 0)
+        return;
+    sel->ids[sel->num] = id;
+    snprintf(sel->names[sel->num], RTE_ETH_XSTATS_NAME_SIZE, "%s", name);
+    sel->num++;
+}
+
+/**
+ * Resolve the ids of the wanted extended statistics of a port once
+ */
+static void
+xstat_resolve(struct xstat_sel* sel, uint16_t port_id) {
+    char name[RTE_ETH_XSTATS_NAME_SIZE];
+    sel->num = 0;
+    for (unsigned loop = 0; loop < RTE_DIM(xstat_wanted); loop++)
+        xstat_add(sel, port_id, xstat_wanted[loop]);
+    for (unsigned loop = 0; loop < RTE_DIM(xstat_wanted_prio); loop++) {
+        for (int prio = 0; prio < 8; prio++) {
+            snprintf(name, sizeof(name), xstat_wanted_prio[loop], prio);
+            xstat_add(sel, port_id, name);
+        }
+    }
+    if (sel->num > 0 && rte_eth_xstats_get_by_id(port_id, sel->ids, sel->pre, sel->num) != sel->num)
+        sel->num = 0;
+}
+
+/**
+ * Look up a single extended statistic, UINT64_MAX if the port does not have it
+ */
+static uint64_t
+xstat_by_name(uint16_t port_id, const char* name) {
+    struct conf_t* conf = get_conf();
+    for (uint16_t index = 0; index < conf->num_port; index++) {
+        struct xstat_sel* sel = &xsel[index];
+        for (uint16_t loop = 0; loop < sel->num && conf->ports[index] == port_id; loop++) {
+            if (strcmp(sel->names[loop], name) == 0) {
+                uint64_t value;
+                if (rte_eth_xstats_get_by_id(port_id, &sel->ids[loop], &value, 1) == 1)
+                    return value;
+            }
+        }
+    }
+    return UINT64_MAX;
+}
 
 struct nstats new_nstats(uint16_t port_id) {
     struct nstats ns;
@@ -33,9 +102,9 @@ struct nstats new_nstats(uint16_t port_id) {
     return ns;
 }
 
-#define XSTAT_SIZE 3000
 void
-print_nstats(struct nstats stat, uint16_t num_queue) {
+print_nstats(struct nstats* nstat, uint16_t num_queue) {
+    struct nstats stat = *nstat;
     gettimeofday(&stat.e_t, NULL);
     stat.elapsed = time_diff(stat.s_t, stat.e_t);
     rte_eth_stats_get(stat.port_id, &stat.stat);
@@ -65,21 +134,8 @@ print_nstats(struct nstats stat, uint16_t num_queue) {
         stat.elapsed
     );
 
-    struct rte_eth_xstat_name xstats_names[XSTAT_SIZE];
-    int num = rte_eth_xstats_get_names(stat.port_id, xstats_names, XSTAT_SIZE);
-
-    struct rte_eth_xstat xstats[XSTAT_SIZE];
-    rte_eth_xstats_get(stat.port_id, xstats, XSTAT_SIZE);
-
-    uint64_t rx_discard = 0xffffffffffffffff;
-    uint64_t tx_discard = 0xffffffffffffffff;
-    for (int loop = 0; loop < num; loop++) {
-        // LOG_INFO("%s: %lu\n", xstats_names[xstats[loop].id].name, xstats[loop].value);
-        if (strcmp(xstats_names[xstats[loop].id].name, "rx_phy_discard_packets") == 0)
-            rx_discard = xstats[loop].value;
-        else if (strcmp(xstats_names[xstats[loop].id].name, "tx_phy_discard_packets") == 0)
-            tx_discard = xstats[loop].value;
-    }
+    uint64_t rx_discard = xstat_by_name(stat.port_id, "rx_phy_discard_packets");
+    uint64_t tx_discard = xstat_by_name(stat.port_id, "tx_phy_discard_packets");
 
     LOG_INFO(
         "RX %11lu Pkts %13lu Bytes  %6.2f Mpps  %6.2f Gbps  %lu Drops\n",
@@ -119,22 +175,55 @@ print_nstats(struct nstats stat, uint16_t num_queue) {
     if (num_queue > RTE_ETHDEV_QUEUE_STAT_CNTRS)
         LOG_INFO(" ...... \n");
     LOG_LINE(75, '-', NULL);
+    *nstat = stat;
 }
 
-void
-print_xstats(uint16_t port_id) {
-    // struct nstats stat;
-    // rte_eth_stats_get(port_id, &stat.stat);
-
-    struct rte_eth_xstat_name xstats_names[XSTAT_SIZE];
-    int num = rte_eth_xstats_get_names(port_id, xstats_names, XSTAT_SIZE);
+/**
+ * Print the sum of all ports and record it as the result of the run
+ */
+static void
+print_total(struct nstats* nstat, uint16_t num_port) {
+    struct rte_eth_stats sum;
+    memset(&sum, 0, sizeof(sum));
+    double elapsed = nstat[0].elapsed;
+    for (uint16_t loop = 0; loop < num_port; loop++) {
+        sum.ipackets += nstat[loop].stat.ipackets;
+        sum.ibytes   += nstat[loop].stat.ibytes;
+        sum.opackets += nstat[loop].stat.opackets;
+        sum.obytes   += nstat[loop].stat.obytes;
+        sum.imissed  += nstat[loop].stat.imissed;
+    }
+    double rx_gbps = (sum.ibytes + SIZE_LINK_OVERHEAD * sum.ipackets) / (125000000 * elapsed);
+    double tx_gbps = (sum.obytes + SIZE_LINK_OVERHEAD * sum.opackets) / (125000000 * elapsed);
+    if (num_port > 1) {
+        LOG_LINE(75, '-', "Total of All Ports");
+        LOG_INFO("RX %11lu Pkts %13lu Bytes  %6.2f Mpps  %6.2f Gbps  %lu Missed\n",
+            sum.ipackets, sum.ibytes, (sum.ipackets / 1000000.0) / elapsed, rx_gbps, sum.imissed);
+        LOG_INFO("TX %11lu Pkts %13lu Bytes  %6.2f Mpps  %6.2f Gbps\n",
+            sum.opackets, sum.obytes, (sum.opackets / 1000000.0) / elapsed, tx_gbps);
+        LOG_LINE(75, '-', NULL);
+    }
 
-    struct rte_eth_xstat xstats[XSTAT_SIZE];
-    rte_eth_xstats_get(port_id, xstats, XSTAT_SIZE);
+    result_set(RES_RX_GBPS, rx_gbps);
+    result_set(RES_TX_GBPS, tx_gbps);
+    result_set(RES_RX_MPPS, (sum.ipackets / 1000000.0) / elapsed);
+    result_set(RES_TX_MPPS, (sum.opackets / 1000000.0) / elapsed);
+}
 
-    for (int loop = 0; loop < num; loop++) {
-        LOG_INFO("%s: %lu\n", xstats_names[xstats[loop].id].name, xstats[loop].value);
+void
+print_xstats(uint16_t port_id) {
+    int num = rte_eth_xstats_get_names(port_id, NULL, 0);
+    if (num <= 0)
+        return;
+    struct rte_eth_xstat_name* xstats_names = (struct rte_eth_xstat_name*) calloc(num, sizeof(struct rte_eth_xstat_name));
+    struct rte_eth_xstat* xstats = (struct rte_eth_xstat*) calloc(num, sizeof(struct rte_eth_xstat));
+    if (rte_eth_xstats_get_names(port_id, xstats_names, num) == num && rte_eth_xstats_get(port_id, xstats, num) == num) {
+        for (int loop = 0; loop < num; loop++) {
+            LOG_INFO("%s: %lu\n", xstats_names[xstats[loop].id].name, xstats[loop].value);
+        }
     }
+    free(xstats_names);
+    free(xstats);
 }
 
 static inline void
@@ -150,49 +239,53 @@ calc_cpu_usage(struct pstats* last_usage, struct pstats* cur_usage, long unsigne
     *scpu_usage = (cur_usage->stime_ticks + cur_usage->cstime_ticks) - (last_usage->stime_ticks + last_usage->cstime_ticks);
 }
 
+/**
+ * Read a whole /proc file from offset 0 into `buff`, NUL terminated
+ */
+static int
+pread_proc(int fd, char* buff, size_t len) {
+    ssize_t ret = pread(fd, buff, len - 1, 0);
+    if (ret <= 0)
+        return -1;
+    buff[ret] = '\0';
+    return 0;
+}
+
 /*
  * read /proc data into the passed struct pstats
  * returns 0 on success, -1 on error
 */
 static int
-get_cpu_usage(char* path, struct pstats* result) {
-    FILE *fpstat = fopen(path, "r");
-    if (fpstat == NULL) {
-        LOG_ERRO("fopen error: %s\n", path);
-        return -1;
-    }
-    FILE *fstat = fopen("/proc/stat", "r");
-    if (fstat == NULL) {
-        LOG_ERRO("fopen error: /proc/stat");
-        fclose(fpstat);
-        return -1;
-    }
+get_cpu_usage(struct stats* tfs, struct pstats* result) {
+    char buff[1024];
 
     // read statisticas from /proc/pid/stat
     bzero(result, sizeof(struct pstats));
     long int rss;
-    if (fscanf(fpstat, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu"
+    if (pread_proc(tfs->fd_pstat, buff, sizeof(buff)) != 0)
+        return -1;
+    // comm may contain spaces, skip to the closing parenthesis
+    char* rest = strrchr(buff, ')');
+    if (rest == NULL || sscanf(rest + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu"
                 "%lu %ld %ld %*d %*d %*d %*d %*u %lu %ld",
                 &result->utime_ticks, &result->stime_ticks,
                 &result->cutime_ticks, &result->cstime_ticks, &result->vsize,
-                &rss) == EOF) {
-        fclose(fpstat);
+                &rss) != 6) {
         return -1;
     }
-    fclose(fpstat);
     result->rss = rss * getpagesize();
 
     //read+calc cpu total time from /proc/stat
     long unsigned int cpu_time[10];
     bzero(cpu_time, sizeof(cpu_time));
-    if (fscanf(fstat, "%*s %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
+    if (pread_proc(tfs->fd_stat, buff, sizeof(buff)) != 0)
+        return -1;
+    if (sscanf(buff, "%*s %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
                 &cpu_time[0], &cpu_time[1], &cpu_time[2], &cpu_time[3],
                 &cpu_time[4], &cpu_time[5], &cpu_time[6], &cpu_time[7],
                 &cpu_time[8], &cpu_time[9]) == EOF) {
-        fclose(fstat);
         return -1;
     }
-    fclose(fstat);
 
     for(int i=0; i < 10;i++)
         result->cpu_total_time += cpu_time[i];
@@ -200,19 +293,14 @@ get_cpu_usage(char* path, struct pstats* result) {
 }
 
 static int
-get_mem_usage(char* path) {
-    FILE* fh = fopen(path, "r");
-    const char* data_mem = "VmRSS:";
-    char buff[64];
-    while(fscanf(fh, "%s", buff) != EOF) {
-        if (strncmp(buff, data_mem, strlen(data_mem)) == 0) {
-            if (fscanf(fh, "%s", buff) != EOF) {
-                break;
-            }
-        }
-    }
-    fclose(fh);
-    return atoi(buff);
+get_mem_usage(struct stats* tfs) {
+    char buff[4096];
+    if (pread_proc(tfs->fd_status, buff, sizeof(buff)) != 0)
+        return 0;
+    char* line = strstr(buff, "VmRSS:");
+    if (line == NULL)
+        return 0;
+    return atoi(line + strlen("VmRSS:"));
 }
 
 static void
@@ -259,49 +347,232 @@ show_cpumem(void) {
     );
     LOG_INFO("%5u  %4luGB  %5.2f%%  %5.2f%%  %5.2f%%   %10d  %10d  %10d\n", ngx_ncpu, mem_size, MinCPU, MaxCPU, AveCPU/(index-1), MinMem, MaxMem, AveMem/(index-1));
     LOG_LINE(75, '-', NULL);
+    if (index > 1) {
+        result_set(RES_CPU, AveCPU / (index-1));
+        result_set(RES_MEM, MaxMem);
+    }
 }
 
-#define TIMER_RESOLUTION_CYCLES 22000000ULL
+/**
+ * Flag the hottest queue if its rate is QUEUE_IMBALANCE_RATIO times the mean
+ */
 static void
-stats_callback(__rte_unused struct rte_timer *timer, void *arg) {
-    prev_tsc = rte_rdtsc();
+check_imbalance(const char* dir, const double* mpps, uint16_t total_lcore, double delta_1, double delta_2) {
+    struct conf_t* conf = get_conf();
+    if (total_lcore <= 2)
+        return;
+    double sum = 0, max = 0;
+    int hot = 1;
+    for (int loop = 1; loop < total_lcore; loop++) {
+        sum += mpps[loop];
+        if (mpps[loop] > max) {
+            max  = mpps[loop];
+            hot  = loop;
+        }
+    }
+    double mean = sum / (total_lcore - 1);
+    // Ignore idle intervals
+    if (sum < 0.001 || max < mean * QUEUE_IMBALANCE_RATIO)
+        return;
+    LOG_WARN("%06.2f-%06.2f  %s imbalance: queue %hu of port %hu carries %.2f Mpps, %.2fx the mean of %.2f Mpps\n",
+        delta_1, delta_2, dir, conf->conn[hot].queue_id, conf->conn[hot].port_id, max, max / mean, mean);
+}
 
-    struct stats* tfs = (struct stats*) arg;
+/**
+ * Print one row of port rates in an interval
+ */
+static inline void
+print_port_rates(const char* port, struct rte_eth_stats* tsp, struct rte_eth_stats* tsc, double delta_1, double delta_2, double delta_3) {
+    LOG_INFO(
+        "%06.2f-%06.2f%4s  "CO_RED"%6.2f %6.2f %6.2f %6.2f"CO_YELLOW" %6.2f %6.2f %6.2f %6.2f"CO_RESET"\n",
+        delta_1,
+        delta_2,
+        port,
+        (tsc->ipackets  - tsp->ipackets) / 1000000.0,
+        (tsc->ibytes    - tsp->ibytes)   / 1000000000.0,
+        (tsc->ipackets  - tsp->ipackets) / (1000000 * delta_3),
+        ((tsc->ipackets - tsp->ipackets) * SIZE_LINK_OVERHEAD + tsc->ibytes - tsp->ibytes) / (125000000 * delta_3),
+        (tsc->opackets  - tsp->opackets) / 1000000.0,
+        (tsc->obytes    - tsp->obytes)   / 1000000000.0,
+        (tsc->opackets  - tsp->opackets) / (1000000 * delta_3),
+        ((tsc->opackets - tsp->opackets) * SIZE_LINK_OVERHEAD + tsc->obytes - tsp->obytes) / (125000000 * delta_3)
+    );
+}
+
+/**
+ * Interval rows go to the terminal only in -t mode, -n and --rtt print their
+ * own report and have no header for them
+ */
+static inline bool
+stat_rows_shown(struct conf_t* conf) {
+    return !(conf->is_rtt == true || conf->data_size > 0);
+}
+
+static void
+stats_callback(struct stats* tfs) {
     struct conf_t* conf = get_conf();
-    rte_eth_stats_get(tfs->port_id, &(tfs->nstat_cur));
-    get_cpu_usage(tfs->cpu_path, &(tfs->pstat_cur));
-    int mem_usage = get_mem_usage(tfs->mem_path);
+    bool shown = stat_rows_shown(conf);
+    for (uint16_t loop = 0; loop < conf->num_port; loop++)
+        rte_eth_stats_get(conf->ports[loop], &(tfs->nstat_cur[loop]));
+    get_cpu_usage(tfs, &(tfs->pstat_cur));
+    int mem_usage = get_mem_usage(tfs);
     gettimeofday(&tfs->cur_t, NULL);
     double delta_1 = time_diff(tfs->base, tfs->pre_t);
     double delta_2 = time_diff(tfs->base, tfs->cur_t);
     double delta_3 = time_diff(tfs->pre_t, tfs->cur_t);
 
-    struct rte_eth_stats tsp = tfs->nstat_pre;
-    struct rte_eth_stats tsc = tfs->nstat_cur;
-    LOG_INFO(
-        "%06.2f-%06.2f   %hu  "CO_RED"%6.2f %6.2f %6.2f %6.2f"CO_YELLOW" %6.2f %6.2f %6.2f %6.2f"CO_RESET"\n",
-        delta_1,
-        delta_2,
-        tfs->port_id,
-        (tsc.ipackets  - tsp.ipackets) / 1000000.0,
-        (tsc.ibytes    - tsp.ibytes)   / 1000000000.0,
-        (tsc.ipackets  - tsp.ipackets) / (1000000 * delta_3),
+    // One row per port, and their sum when there are several
+    struct rte_eth_stats tsp, tsc;
+    memset(&tsp, 0, sizeof(tsp));
+    memset(&tsc, 0, sizeof(tsc));
+    for (uint16_t loop = 0; loop < conf->num_port; loop++) {
+        char port[8];
+        snprintf(port, sizeof(port), "%hu", conf->ports[loop]);
+        if (shown)
+            print_port_rates(port, &tfs->nstat_pre[loop], &tfs->nstat_cur[loop], delta_1, delta_2, delta_3);
+        tsp.ipackets += tfs->nstat_pre[loop].ipackets;
+        tsp.ibytes   += tfs->nstat_pre[loop].ibytes;
+        tsp.opackets += tfs->nstat_pre[loop].opackets;
+        tsp.obytes   += tfs->nstat_pre[loop].obytes;
+        tsc.ipackets += tfs->nstat_cur[loop].ipackets;
+        tsc.ibytes   += tfs->nstat_cur[loop].ibytes;
+        tsc.opackets += tfs->nstat_cur[loop].opackets;
+        tsc.obytes   += tfs->nstat_cur[loop].obytes;
+    }
+    if (shown && conf->num_port > 1)
+        print_port_rates("Sum", &tsp, &tsc, delta_1, delta_2, delta_3);
+
+    // Sum up the per-thread slots, each one is only written by its owner
+    const struct app_stat_t* slots = get_app_stat();
+    struct app_stat_t app_cur[MAX_LCORE];
+    struct app_stat_t delta = {0};
+    char util[16 * MAX_LCORE] = {0};
+    int util_len = 0;
+    struct app_stat_t sw[MAX_LCORE];
+    for (int loop = 1; loop < conf->total_lcore; loop++) {
+        app_cur[loop] = slots[loop];
+        struct app_stat_t* cur = &app_cur[loop];
+        struct app_stat_t* pre = &app_pre[loop];
+        delta.sent_pkts   += cur->sent_pkts   - pre->sent_pkts;
+        delta.sent_bytes  += cur->sent_bytes  - pre->sent_bytes;
+        delta.acked_pkts  += cur->acked_pkts  - pre->acked_pkts;
+        delta.acked_bytes += cur->acked_bytes - pre->acked_bytes;
+        delta.retrans     += cur->retrans     - pre->retrans;
+        delta.empty_polls += cur->empty_polls - pre->empty_polls;
+        delta.polls       += cur->polls       - pre->polls;
+        delta.tx_stalls   += cur->tx_stalls   - pre->tx_stalls;
+        delta.busy_cycles += cur->busy_cycles - pre->busy_cycles;
+        uint64_t busy   = cur->busy_cycles - pre->busy_cycles;
+        uint64_t cycles = busy + cur->idle_cycles - pre->idle_cycles;
+        util_len += sprintf(util + util_len, "  %02d %5.1f%%", loop, cycles > 0 ? busy * 100.0 / cycles : 0);
+        sw[loop].sent_pkts   = cur->sent_pkts   - pre->sent_pkts;
+        sw[loop].sent_bytes  = cur->sent_bytes  - pre->sent_bytes;
+        sw[loop].acked_pkts  = cur->acked_pkts  - pre->acked_pkts;
+        sw[loop].acked_bytes = cur->acked_bytes - pre->acked_bytes;
+        *pre = *cur;
+    }
+    // UDP is fire-and-forget, its goodput is what has been sent
+    uint64_t goodput = (conf->is_client == true && conf->is_udp == true) ? delta.sent_bytes : delta.acked_bytes;
+    uint64_t pkts = delta.sent_pkts + delta.acked_pkts;
+    if (shown) {
+        LOG_INFO(
+            "%06.2f-%06.2f  App  %6.2f Mpps sent  %6.2f Gbps goodput  %8lu retrans  %8lu stalls  %5.1f%% empty polls  %5.0f cyc/pkt\n",
+            delta_1,
+            delta_2,
+            delta.sent_pkts / (1000000 * delta_3),
+            goodput / (125000000 * delta_3),
+            delta.retrans,
+            delta.tx_stalls,
+            delta.polls > 0 ? delta.empty_polls * 100.0 / delta.polls : 0,
+            pkts > 0 ? (double) delta.busy_cycles / pkts : 0
+        );
+        LOG_INFO("%06.2f-%06.2f  Util%s\n", delta_1, delta_2, util);
+    }
+    result_add_interval(delta_2,
         ((tsc.ipackets - tsp.ipackets) * SIZE_LINK_OVERHEAD + tsc.ibytes - tsp.ibytes) / (125000000 * delta_3),
-        (tsc.opackets  - tsp.opackets) / 1000000.0,
-        (tsc.obytes    - tsp.obytes)   / 1000000000.0,
-        (tsc.opackets  - tsp.opackets) / (1000000 * delta_3),
-        ((tsc.opackets - tsp.opackets) * SIZE_LINK_OVERHEAD + tsc.obytes - tsp.obytes) / (125000000 * delta_3)
-    );
-    memcpy(&tfs->nstat_pre, &tfs->nstat_cur, sizeof(struct rte_eth_stats));
+        ((tsc.opackets - tsp.opackets) * SIZE_LINK_OVERHEAD + tsc.obytes - tsp.obytes) / (125000000 * delta_3),
+        (tsc.ipackets - tsp.ipackets) / (1000000 * delta_3),
+        (tsc.opackets - tsp.opackets) / (1000000 * delta_3),
+        goodput / (125000000 * delta_3));
+
+    // Per-queue rates of the worker queues. Hardware counters where the port
+    // has them, beyond RTE_ETHDEV_QUEUE_STAT_CNTRS the software counters of
+    // the owning thread (marked *, payload bytes only)
+    double rx_mpps[MAX_LCORE], tx_mpps[MAX_LCORE];
+    char rxq[32 * MAX_LCORE] = {0};
+    char txq[32 * MAX_LCORE] = {0};
+    int rxq_len = 0, txq_len = 0;
+    // With several ports a queue is labelled <port>.<queue>
+    for (int loop = 1; loop < conf->total_lcore; loop++) {
+        uint16_t qid = conf->conn[loop].queue_id;
+        struct rte_eth_stats* qsp = &tfs->nstat_pre[conf->conn[loop].port_index];
+        struct rte_eth_stats* qsc = &tfs->nstat_cur[conf->conn[loop].port_index];
+        bool hw = (qid < RTE_ETHDEV_QUEUE_STAT_CNTRS);
+        uint64_t rx_pkts  = hw ? qsc->q_ipackets[qid] - qsp->q_ipackets[qid] : sw[loop].acked_pkts;
+        uint64_t rx_bytes = hw ? qsc->q_ibytes[qid]   - qsp->q_ibytes[qid]   : sw[loop].acked_bytes;
+        uint64_t tx_pkts  = hw ? qsc->q_opackets[qid] - qsp->q_opackets[qid] : sw[loop].sent_pkts;
+        uint64_t tx_bytes = hw ? qsc->q_obytes[qid]   - qsp->q_obytes[qid]   : sw[loop].sent_bytes;
+        char label[16];
+        if (conf->num_port > 1)
+            snprintf(label, sizeof(label), "%hu.%02hu%s", conf->conn[loop].port_id, qid, hw ? "" : "*");
+        else
+            snprintf(label, sizeof(label), "%02hu%s", qid, hw ? "" : "*");
+        rx_mpps[loop] = rx_pkts / (1000000 * delta_3);
+        tx_mpps[loop] = tx_pkts / (1000000 * delta_3);
+        rxq_len += sprintf(rxq + rxq_len, "  %s %6.2f/%6.2f", label, rx_mpps[loop], rx_bytes / (125000000 * delta_3));
+        txq_len += sprintf(txq + txq_len, "  %s %6.2f/%6.2f", label, tx_mpps[loop], tx_bytes / (125000000 * delta_3));
+    }
+    memcpy(tfs->nstat_pre, tfs->nstat_cur, sizeof(tfs->nstat_cur));
+    if (conf->is_pmu == true) {
+        uint64_t val[NUM_PMU], pmu_delta[NUM_PMU];
+        char pline[48 * MAX_LCORE] = {0};
+        int plen = 0;
+        for (int loop = 1; loop < conf->total_lcore; loop++) {
+            pmu_read(loop, val, pmu_delta);
+            uint64_t pkts = sw[loop].sent_pkts + sw[loop].acked_pkts;
+            if (pkts == 0 || pmu_delta[PMU_CYCLES] == UINT64_MAX)
+                continue;
+            plen += sprintf(pline + plen, "  %02d %.2f IPC %.0f cyc %.2f llc %.2f br",
+                loop,
+                pmu_delta[PMU_INSTRUCTIONS] == UINT64_MAX ? 0 : (double) pmu_delta[PMU_INSTRUCTIONS] / RTE_MAX(pmu_delta[PMU_CYCLES], 1UL),
+                (double) pmu_delta[PMU_CYCLES] / pkts,
+                pmu_delta[PMU_LLC_MISSES] == UINT64_MAX ? 0 : (double) pmu_delta[PMU_LLC_MISSES] / pkts,
+                pmu_delta[PMU_BRANCH_MISSES] == UINT64_MAX ? 0 : (double) pmu_delta[PMU_BRANCH_MISSES] / pkts);
+        }
+        if (shown && plen > 0)
+            LOG_INFO("%06.2f-%06.2f  PMU/Pkt%s\n", delta_1, delta_2, pline);
+    }
+    if (shown) {
+        LOG_INFO("%06.2f-%06.2f  RXQ (Mpps/Gbps)%s\n", delta_1, delta_2, rxq);
+        LOG_INFO("%06.2f-%06.2f  TXQ (Mpps/Gbps)%s\n", delta_1, delta_2, txq);
+        check_imbalance("RX", rx_mpps, conf->total_lcore, delta_1, delta_2);
+        check_imbalance("TX", tx_mpps, conf->total_lcore, delta_1, delta_2);
+    }
+
+    // Only counters that moved in this interval, so drops show up as they happen
+    uint64_t xcur[MAX_XSTAT_SEL];
+    for (uint16_t index = 0; index < conf->num_port; index++) {
+        struct xstat_sel* sel = &xsel[index];
+        if (sel->num == 0 || rte_eth_xstats_get_by_id(conf->ports[index], sel->ids, xcur, sel->num) != sel->num)
+            continue;
+        char xline[1024] = {0};
+        int xlen = 0;
+        for (uint16_t loop = 0; loop < sel->num; loop++) {
+            if (xcur[loop] != sel->pre[loop] && xlen < (int) sizeof(xline) - RTE_ETH_XSTATS_NAME_SIZE - 24)
+                xlen += sprintf(xline + xlen, "  %s=%lu", sel->names[loop], xcur[loop] - sel->pre[loop]);
+            sel->pre[loop] = xcur[loop];
+        }
+        if (shown && xlen > 0)
+            LOG_WARN("%06.2f-%06.2f  Xstats %hu%s\n", delta_1, delta_2, conf->ports[index], xline);
+    }
 
     char temp[100] = {0};
 
     double a, b;
     calc_cpu_usage_pct(&tfs->pstat_pre, &tfs->pstat_cur, &a, &b);
-    sprintf(temp, "%06.2f-%06.2f    %06.2f  %06.2f  %06.2f  %8d\n", delta_1, delta_2, a, b, a+b, mem_usage);
-    FILE* fh = fopen(conf->path_to_cpumem, "a");
-    fputs(temp, fh);
-    fclose(fh);
+    int len = sprintf(temp, "%06.2f-%06.2f    %06.2f  %06.2f  %06.2f  %8d\n", delta_1, delta_2, a, b, a+b, mem_usage);
+    if (write(tfs->fd_cpumem, temp, len) != len)
+        LOG_WARN("Cannot write to %s\n", conf->path_to_cpumem);
 
     memcpy(&tfs->pre_t, &tfs->cur_t, sizeof(struct timeval));
     memcpy(&tfs->pstat_pre, &tfs->pstat_cur, sizeof(struct pstats));
@@ -353,34 +624,71 @@ stats_callback(__rte_unused struct rte_timer *timer, void *arg) {
 
 // }
 
+/**
+ * Sleep until `deadline` in short steps so that exit_stat() does not wait for
+ * a whole interval
+ */
+static void
+sleep_until(struct timespec* deadline) {
+    struct timespec step = { .tv_sec = 0, .tv_nsec = 10000000 };
+    struct timespec now;
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (tfs.stop == true || now.tv_sec > deadline->tv_sec ||
+            (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec))
+            return;
+        nanosleep(&step, NULL);
+    }
+}
+
+static void*
+stat_sampler(void* arg) {
+    struct stats* tfs = (struct stats*) arg;
+    struct conf_t* conf = get_conf();
+    uint64_t interval_ns = time_double(conf->interval) * 1000000000;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    for (;;) {
+        // Absolute deadlines, so the sampling time does not drift the interval
+        deadline.tv_nsec += interval_ns % 1000000000;
+        deadline.tv_sec  += interval_ns / 1000000000 + deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        sleep_until(&deadline);
+        if (tfs->stop == true)
+            break;
+        stats_callback(tfs);
+    }
+    return NULL;
+}
+
 void init_stat(void) {
     struct conf_t* conf = get_conf();
-    ethstat = new_nstats(conf->port_id);
+    for (uint16_t loop = 0; loop < conf->num_port; loop++) {
+        ethstat[loop] = new_nstats(conf->ports[loop]);
+        xstat_resolve(&xsel[loop], conf->ports[loop]);
+    }
+    memset(app_pre, 0, sizeof(app_pre));
 
-    // uint64_t prev_tsc = 0, cur_tsc, diff_tsc;
-    uint64_t prev_tsc = 0;
-    // struct stats tfs = {0};
     sprintf(tfs.cpu_path, "/proc/%u/stat", getpid());
     sprintf(tfs.mem_path, "/proc/%u/status", getpid());
-    get_cpu_usage(tfs.cpu_path, &tfs.pstat_pre);
-    tfs.port_id = conf->port_id;
+    // Opened once, every sample is a pread from offset 0
+    tfs.fd_pstat  = open(tfs.cpu_path, O_RDONLY);
+    tfs.fd_stat   = open("/proc/stat", O_RDONLY);
+    tfs.fd_status = open(tfs.mem_path, O_RDONLY);
+    tfs.fd_cpumem = open(conf->path_to_cpumem, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (tfs.fd_pstat < 0 || tfs.fd_stat < 0 || tfs.fd_status < 0 || tfs.fd_cpumem < 0) {
+        LOG_ERRO("Cannot open %s, /proc/stat, %s or %s\n", tfs.cpu_path, tfs.mem_path, conf->path_to_cpumem);
+        exit(-1);
+    }
+    get_cpu_usage(&tfs, &tfs.pstat_pre);
     gettimeofday(&tfs.base,  NULL);
     gettimeofday(&tfs.pre_t, NULL);
 
-    FILE* fh = fopen(conf->path_to_cpumem, "w");
-    char header[100] = {0};
-    sprintf(header, "Time Interval     %%User    %%Sys  %%Total  Mem (KB)\n");
-    fputs(header, fh);
-    fclose(fh);
+    const char* header = "Time Interval     %User    %Sys  %Total  Mem (KB)\n";
+    if (write(tfs.fd_cpumem, header, strlen(header)) < 0)
+        LOG_WARN("Cannot write to %s\n", conf->path_to_cpumem);
 
-    // Initializes internal variables (list, locks and so on) for the RTE timer library.
-    rte_timer_subsystem_init();
-    rte_timer_init(&timer);
-    // Get the number of cycles in one second
-    uint64_t hz = rte_get_timer_hz();
-    rte_timer_reset(&timer, time_double(conf->interval) * hz, PERIODICAL, rte_lcore_id(), stats_callback, &tfs);
-
-    if (!(conf->is_rtt == true || conf->data_size > 0)) {
+    if (stat_rows_shown(conf) == true) {
         LOG_INFO(
             "%s                  %s %s             In            %s %s            Out            %s\n",
             BG_GREEN, BG_RESET, BG_RED, BG_RESET, BG_YELLOW, BG_RESET
@@ -391,30 +699,37 @@ void init_stat(void) {
         );
     }
 
-    prev_tsc = rte_rdtsc();
-    base_tsc = prev_tsc;
+    tfs.stop = false;
+    if (rte_ctrl_thread_create(&tfs.sampler, "dperf-stat", NULL, stat_sampler, &tfs) != 0) {
+        LOG_ERRO("Cannot create the statistics thread\n");
+        exit(-1);
+    }
+    burst_start();
+    base_tsc = rte_rdtsc();
 }
 
 int update_stat(uint64_t limit) {
-    uint64_t cur_tsc = rte_rdtsc();
-    uint64_t diff_tsc = cur_tsc - prev_tsc;
-    if (diff_tsc > TIMER_RESOLUTION_CYCLES) {
-        rte_timer_manage();
-        // prev_tsc = cur_tsc;
-    }
-    if (cur_tsc - base_tsc > limit)
+    if (rte_rdtsc() - base_tsc > limit)
         return 1;
     else
         return 0;
-    // rte_delay_ms(1);
 }
 
 void exit_stat(void) {
     struct conf_t* conf = get_conf();
-    print_nstats(ethstat, conf->total_lcore);
-    rte_timer_stop(&timer);
-    // Free timer subsystem resources.
-    rte_timer_subsystem_finalize();
+    if (tfs.fd_cpumem >= 0) {
+        tfs.stop = true;
+        pthread_join(tfs.sampler, NULL);
+        close(tfs.fd_pstat);
+        close(tfs.fd_stat);
+        close(tfs.fd_status);
+        close(tfs.fd_cpumem);
+        tfs.fd_cpumem = -1;
+    }
+    burst_stop();
+    for (uint16_t loop = 0; loop < conf->num_port; loop++)
+        print_nstats(&ethstat[loop], conf->num_queue[loop]);
+    print_total(ethstat, conf->num_port);
     if (conf->data_size == 0 && conf->is_rtt == false)
         show_cpumem();
-} 
\ No newline at end of file
+}
@@ -1,6 +1,11 @@
 #ifndef _STAT_H_
 #define _STAT_H_
 
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "conf.h"
+
 /**
  * Process CPU usage statisticas
  * https://man7.org/linux/man-pages/man5/proc.5.html
@@ -45,20 +50,46 @@ struct nstats {
     struct rte_eth_stats stat;                       // Statistics from an Ethernet port
 };
 
+/**
+ * A queue is flagged as hot when its packet rate exceeds the mean of all
+ * worker queues by this ratio
+ */
+#define QUEUE_IMBALANCE_RATIO 1.5
+
+/**
+ * Max number of extended statistics sampled every interval
+ */
+#define MAX_XSTAT_SEL 64
+
+/**
+ * Extended statistics resolved by name once, then sampled by id
+ */
+struct xstat_sel {
+    uint16_t num;
+    uint64_t ids[MAX_XSTAT_SEL];
+    uint64_t pre[MAX_XSTAT_SEL];                     // Values at the previous interval
+    char names[MAX_XSTAT_SEL][RTE_ETH_XSTATS_NAME_SIZE];
+};
+
 /**
  * All statistics
  */
 struct stats {
-    uint16_t port_id;
     struct timeval base;
     struct timeval pre_t;
     struct timeval cur_t;
-    struct rte_eth_stats nstat_pre;
-    struct rte_eth_stats nstat_cur;
+    struct rte_eth_stats nstat_pre[MAX_PORT];       // Indexed like conf->ports
+    struct rte_eth_stats nstat_cur[MAX_PORT];
     struct pstats pstat_pre;
     struct pstats pstat_cur;
     char cpu_path[30];
     char mem_path[30];
+    int fd_pstat;                                    // /proc/<pid>/stat, kept open and read with pread
+    int fd_stat;                                     // /proc/stat
+    int fd_status;                                   // /proc/<pid>/status
+    int fd_cpumem;                                   // CPU/Mem usage log, appended every interval
+    pthread_t sampler;                               // Control thread running the periodic sampling
+    volatile bool stop;
 };
 
 /**
@@ -74,11 +105,11 @@ struct nstats new_nstats(uint16_t port_id);
  * Retrieve and print the general I/O statistics of an Ethernet device.
  *
  * @para nic_stats
- *   NIC statistics.
+ *   NIC statistics, the counters and the elapsed time are updated
  * @para num_queue
  *   Number of queues needed to be retrieved
  */
-void print_nstats(struct nstats stat, uint16_t num_queue);
+void print_nstats(struct nstats* stat, uint16_t num_queue);
 /**
  * Print the extended statistics of an Ethernet device, e.g., rx_discards_phy and tx_discards_phy.
  *
@@ -99,8 +130,24 @@ void print_xstats(uint16_t port_id);
  */
 void print_stats_with_interval(uint16_t port_id, uint64_t interval);
 
+/**
+ * Reset port statistics and start the sampling thread. It is a control thread
+ * (rte_ctrl_thread_create), i.e., it runs on cores not used by the EAL, so
+ * that neither the dataplane nor the task loop of the main lcore wait on
+ * /proc reads or log writes.
+ */
 void init_stat(void);
+/**
+ * @para limit
+ *   Test duration (cycles)
+ * @return
+ *   - 1: `limit` cycles have elapsed since init_stat()
+ *   - 0: Otherwise
+ */
 int update_stat(uint64_t limit);
+/**
+ * Stop the sampling thread and print the summary
+ */
 void exit_stat(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include <rte_common.h>
+#include <rte_mempool.h>
+
+#include "util.h"
+#include "conf.h"
+#include "result.h"
+#include "sweep.h"
+
+struct sweep_param_t {
+    int param;                  // SWEEP_XX
+    uint16_t num;
+    uint32_t values[SWEEP_MAX_VALUES];
+};
+
+struct sweep_trial_t {
+    uint32_t values[NUM_SWEEP];
+    double metrics[NUM_RES];
+};
+
+static const char* sweep_name[NUM_SWEEP] = { "rxd", "txd", "burst", "pool", "mcache" };
+
+struct sweep_param_t grid[NUM_SWEEP];
+uint16_t num_param = 0;
+uint32_t num_grid = 0;
+uint32_t max_pool = 0;
+struct sweep_trial_t trials[SWEEP_MAX_TRIALS];
+char base_tag[LEN_PATH];
+
+static int
+sweep_check(int param, uint32_t value) {
+    switch (param) {
+    case SWEEP_RXD:
+    case SWEEP_TXD:
+        return (value > 0 && value <= UINT16_MAX) ? 0 : -1;
+    case SWEEP_BURST:
+        return (value > 0 && value <= MAX_SIZE_BURST) ? 0 : -1;
+    case SWEEP_POOL:
+        return (value > 0) ? 0 : -1;
+    case SWEEP_MCACHE:
+        return (value <= RTE_MEMPOOL_CACHE_MAX_SIZE) ? 0 : -1;
+    }
+    return -1;
+}
+
+/**
+ * Set the parameters of a trial in the global configuration, `value` gets the
+ * value of each parameter of the grid
+ */
+static void
+sweep_set(uint32_t trial, uint32_t* value) {
+    struct conf_t* conf = get_conf();
+    // Mixed radix, the last parameter varies fastest
+    uint32_t index = trial;
+    for (int loop = num_param - 1; loop >= 0; loop--) {
+        value[loop] = grid[loop].values[index % grid[loop].num];
+        index /= grid[loop].num;
+    }
+    for (int loop = 0; loop < num_param; loop++) {
+        switch (grid[loop].param) {
+        case SWEEP_RXD:    conf->ring_rx    = value[loop]; break;
+        case SWEEP_TXD:    conf->ring_tx    = value[loop]; break;
+        case SWEEP_BURST:  conf->burst_rx   = value[loop];
+                           conf->burst_tx   = value[loop]; break;
+        case SWEEP_POOL:   conf->pool_size  = value[loop];
+                           conf->is_pool_fit= false; break;
+        case SWEEP_MCACHE: conf->pool_cache = value[loop]; break;
+        }
+    }
+    // Pools not in the grid follow the rings and bursts of the trial
+    if (conf->is_pool_fit == true)
+        conf->pool_size = pool_fit(conf);
+}
+
+/**
+ * Check the combination of every trial the way opt_parser() checks the
+ * options, before any port is stopped for it
+ */
+static int
+sweep_check_trials(void) {
+    struct conf_t* conf = get_conf();
+    uint16_t ring_rx  = conf->ring_rx,  ring_tx  = conf->ring_tx;
+    uint16_t burst_rx = conf->burst_rx, burst_tx = conf->burst_tx;
+    uint32_t pool_size = conf->pool_size, pool_cache = conf->pool_cache;
+    bool is_pool_fit = conf->is_pool_fit;
+    int ret = 0;
+    for (uint32_t trial = 0; trial < num_grid && ret == 0; trial++) {
+        uint32_t value[NUM_SWEEP];
+        sweep_set(trial, value);
+        max_pool = RTE_MAX(max_pool, conf->pool_size);
+        // A cache above pool/1.5 leaves the other lcores with no mbuf
+        if (conf->pool_cache * 1.5 > conf->pool_size) {
+            LOG_ERRO("--sweep trial %u has an mcache of %u, more than %.0f%% of its pool of %u\n",
+                trial + 1, conf->pool_cache, 100 / 1.5, conf->pool_size);
+            ret = -1;
+        }
+    }
+    conf->ring_rx  = ring_rx;  conf->ring_tx  = ring_tx;
+    conf->burst_rx = burst_rx; conf->burst_tx = burst_tx;
+    conf->pool_size = pool_size; conf->pool_cache = pool_cache;
+    conf->is_pool_fit = is_pool_fit;
+    return ret;
+}
+
+int
+sweep_parse(const char* spec) {
+    char temp[LEN_PATH] = {0};
+    strncpy(temp, spec, LEN_PATH-1);
+    num_param = 0;
+    num_grid  = 1;
+
+    char* rest = temp;
+    char* token;
+    while ((token = strtok_r(rest, ",", &rest))) {
+        char* values = strchr(token, '=');
+        if (values == NULL || num_param == NUM_SWEEP) {
+            LOG_ERRO("Invalid --sweep %s, expect <param>=<v>[:<v>...][,...]\n", spec);
+            return -1;
+        }
+        *values++ = '\0';
+        struct sweep_param_t* p = &grid[num_param];
+        p->param = -1;
+        for (int loop = 0; loop < NUM_SWEEP; loop++) {
+            if (strcmp(token, sweep_name[loop]) == 0)
+                p->param = loop;
+        }
+        for (int loop = 0; loop < num_param; loop++) {
+            if (grid[loop].param == p->param)
+                p->param = -1;
+        }
+        if (p->param < 0) {
+            LOG_ERRO("Unknown or repeated --sweep parameter %s, expect rxd|txd|burst|pool|mcache\n", token);
+            return -1;
+        }
+        p->num = 0;
+        char* value;
+        while ((value = strtok_r(values, ":", &values))) {
+            if (p->num == SWEEP_MAX_VALUES || sweep_check(p->param, atoi(value)) != 0) {
+                LOG_ERRO("Invalid --sweep values of %s (at most %d, each in range)\n", token, SWEEP_MAX_VALUES);
+                return -1;
+            }
+            p->values[p->num++] = atoi(value);
+        }
+        if (p->num == 0) {
+            LOG_ERRO("No value for --sweep parameter %s\n", token);
+            return -1;
+        }
+        num_grid *= p->num;
+        num_param++;
+    }
+    if (num_param == 0 || num_grid > SWEEP_MAX_TRIALS) {
+        LOG_ERRO("--sweep needs 1 to %d trials, %u given\n", SWEEP_MAX_TRIALS, num_param == 0 ? 0 : num_grid);
+        return -1;
+    }
+    if (sweep_check_trials() != 0)
+        return -1;
+    strcpy(base_tag, get_conf()->result_tag);
+    return num_grid;
+}
+
+uint32_t
+sweep_num_trial(void) {
+    return num_grid;
+}
+
+uint32_t
+sweep_max_pool(void) {
+    return max_pool;
+}
+
+void
+sweep_apply(uint32_t trial) {
+    struct conf_t* conf = get_conf();
+    struct sweep_trial_t* t = &trials[trial];
+    char label[LEN_PATH] = {0};
+    int len = snprintf(label, sizeof(label), "%s/", base_tag);
+
+    uint32_t value[NUM_SWEEP];
+    sweep_set(trial, value);
+    for (int loop = 0; loop < num_param; loop++)
+        len += snprintf(label + len, sizeof(label) - len, "%s%s=%u", loop > 0 ? "," : "", sweep_name[grid[loop].param], value[loop]);
+    t->values[SWEEP_RXD]    = conf->ring_rx;
+    t->values[SWEEP_TXD]    = conf->ring_tx;
+    t->values[SWEEP_BURST]  = conf->burst_rx;
+    t->values[SWEEP_POOL]   = conf->pool_size;
+    t->values[SWEEP_MCACHE] = conf->pool_cache;
+    strncpy(conf->result_tag, label, LEN_PATH-1);
+    LOG_LINE(75, '=', "Sweep");
+    LOG_INFO("Trial %u/%u: %s\n", trial + 1, num_grid, label + strlen(base_tag) + 1);
+}
+
+void
+sweep_record(uint32_t trial) {
+    for (int loop = 0; loop < NUM_RES; loop++)
+        trials[trial].metrics[loop] = result_get(loop);
+}
+
+void
+sweep_report(uint32_t num_trial) {
+    struct conf_t* conf = get_conf();
+    if (num_trial == 0)
+        return;
+    // Throughput of the mode: transactions in --rr, TX Mpps in --mpps, goodput otherwise
+    int metric = conf->is_rr ? RES_TPS : conf->is_pps ? RES_TX_MPPS : RES_GOODPUT;
+    int best = -1, best_lat = -1;
+
+    LOG_LINE(75, '-', "Sweep Results");
+    LOG_INFO("  rxd    txd  burst    pool  mcache   RX Gbps   TX Gbps   RX Mpps   TX Mpps   Goodput   P99 (ns)\n");
+    for (uint32_t loop = 0; loop < num_trial; loop++) {
+        struct sweep_trial_t* t = &trials[loop];
+        LOG_INFO("%5u  %5u  %5u  %6u  %6u  %8.2f  %8.2f  %8.2f  %8.2f  %8.2f  %9.0f\n",
+            t->values[SWEEP_RXD], t->values[SWEEP_TXD], t->values[SWEEP_BURST], t->values[SWEEP_POOL], t->values[SWEEP_MCACHE],
+            t->metrics[RES_RX_GBPS], t->metrics[RES_TX_GBPS], t->metrics[RES_RX_MPPS], t->metrics[RES_TX_MPPS],
+            t->metrics[RES_GOODPUT], t->metrics[RES_P99]);
+        if (!isnan(t->metrics[metric]) && (best < 0 || t->metrics[metric] > trials[best].metrics[metric]))
+            best = loop;
+        if (!isnan(t->metrics[RES_P99]) && (best_lat < 0 || t->metrics[RES_P99] < trials[best_lat].metrics[RES_P99]))
+            best_lat = loop;
+    }
+    LOG_LINE(75, '-', NULL);
+    if (best >= 0) {
+        struct sweep_trial_t* t = &trials[best];
+        LOG_INFO("Throughput optimal: --rxd %u --txd %u --burst %u --pool %u --mcache %u (%.2f %s)\n",
+            t->values[SWEEP_RXD], t->values[SWEEP_TXD], t->values[SWEEP_BURST], t->values[SWEEP_POOL], t->values[SWEEP_MCACHE],
+            t->metrics[metric], conf->is_rr ? "transactions/s" : conf->is_pps ? "Mpps" : "Gbps goodput");
+    }
+    if (best_lat >= 0) {
+        struct sweep_trial_t* t = &trials[best_lat];
+        LOG_INFO("Latency optimal:    --rxd %u --txd %u --burst %u --pool %u --mcache %u (P99 %.0f ns)\n",
+            t->values[SWEEP_RXD], t->values[SWEEP_TXD], t->values[SWEEP_BURST], t->values[SWEEP_POOL], t->values[SWEEP_MCACHE],
+            t->metrics[RES_P99]);
+    }
+}
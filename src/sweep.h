@@ -0,0 +1,70 @@
+#ifndef _SWEEP_H_
+#define _SWEEP_H_
+
+#include <stdint.h>
+
+#include "conf.h"
+
+/**
+ * Parameters of the --sweep grid
+ */
+#define SWEEP_RXD             0
+#define SWEEP_TXD             1
+#define SWEEP_BURST           2
+#define SWEEP_POOL            3
+#define SWEEP_MCACHE          4
+#define NUM_SWEEP             5
+/**
+ * Max number of values per parameter and of trials in the grid
+ */
+#define SWEEP_MAX_VALUES      8
+#define SWEEP_MAX_TRIALS      256
+
+/**
+ * Parse a parameter grid, e.g., "rxd=512:1024:2048,burst=16:32:64". Every
+ * combination is a trial, the first parameter varies slowest.
+ *
+ * @para spec
+ *   <param>=<v>[:<v>...][,<param>=...], param is rxd|txd|burst|pool|mcache
+ * @return
+ *   - Number of trials
+ *   - -1: Invalid grid
+ */
+int sweep_parse(const char* spec);
+
+/**
+ * Number of trials of the grid given to sweep_parse()
+ */
+uint32_t sweep_num_trial(void);
+
+/**
+ * Largest pool of a thread over the trials of the grid
+ */
+uint32_t sweep_max_pool(void);
+
+/**
+ * Set the parameters of a trial in the global configuration and label the
+ * results record of the trial with them (--tag/<params>)
+ *
+ * @para trial
+ *   Index of the trial
+ */
+void sweep_apply(uint32_t trial);
+
+/**
+ * Keep the summary metrics of a finished trial
+ *
+ * @para trial
+ *   Index of the trial
+ */
+void sweep_record(uint32_t trial);
+
+/**
+ * Print every trial and the throughput and latency optimal parameters
+ *
+ * @para num_trial
+ *   Number of trials run, less than the grid if interrupted
+ */
+void sweep_report(uint32_t num_trial);
+
+#endif
@@ -146,29 +146,25 @@ nic_getnumanode_by_businfo(const char* businfo) {
 
 int
 nic_getcpus_by_numa(int numa_node, char** cpu_list) {
-    char match[10] = {0};
-    sprintf(match, "node%d", numa_node);
+    char path[64] = {0};
+    sprintf(path, "/sys/devices/system/node/node%d/cpulist", numa_node);
 
     *cpu_list = NULL;
 
-    int ignored = 0;
-    FILE* fp = popen("lscpu", "r");
-    if (fp != NULL) {
-        char buff [256] = {0};
-        while (fscanf(fp, "%s", buff) != EOF) {
-            if (strncmp(buff, "NUMA", strlen("NUMA")) == 0) {
-                ignored = fscanf(fp, "%s", buff);
-                if (strncmp(buff, match, strlen(match)) == 0) {
-                    ignored = fscanf(fp, "%s", buff);
-                    ignored = fscanf(fp, "%s", buff);
-                    *cpu_list = (char*) calloc(128, sizeof(char));
-                    strcpy(*cpu_list, buff);
-                    break;
-                }
-            }
-        }
-        fclose(fp);
+    FILE* fp = fopen(path, "r");
+    // Kernels without NUMA have no node directory, all CPUs are on node 0
+    if (fp == NULL && numa_node == 0)
+        fp = fopen("/sys/devices/system/cpu/online", "r");
+    if (fp == NULL)
+        return -1;
+    *cpu_list = (char*) calloc(LEN_CPU_LIST, sizeof(char));
+    if (fgets(*cpu_list, LEN_CPU_LIST, fp) == NULL || (*cpu_list)[0] == '\n') {
+        free(*cpu_list);
+        *cpu_list = NULL;
+    } else {
+        (*cpu_list)[strcspn(*cpu_list, "\n")] = '\0';
     }
+    fclose(fp);
 
     if (*cpu_list == NULL) {
         return -1;
@@ -263,8 +259,8 @@ nic_getarp_by_ip(char* ip_addr) {
 int 
 cpu_getmask(char* cpu_list, int num_core, char** core_mask) {
     int allocated_core = 0;
-    char str_temp[256] = {0};
-    strcpy(str_temp, cpu_list);
+    char str_temp[LEN_CPU_LIST] = {0};
+    strncpy(str_temp, cpu_list, LEN_CPU_LIST - 1);
 
     int index = 0;
     char cores[64][32] = {0};
@@ -283,7 +279,8 @@ cpu_getmask(char* cpu_list, int num_core, char** core_mask) {
         ptr = strtok(cores[loop], "-");
         left = atof(ptr);
         ptr = strtok(NULL, "-");
-        right = atof(ptr);
+        // A single CPU, e.g. "5" in "0-3,5"
+        right = (ptr == NULL) ? left : atof(ptr);
         for (int idx = left; idx <= right; idx++) {
             if (idx >= max_core)
                 break;
@@ -320,6 +317,152 @@ cpu_getmask(char* cpu_list, int num_core, char** core_mask) {
     return allocated_core;
 }
 
+/**
+ * Parse a CPU list ("0-3,8,10-11") into `set`, `list` is modified
+ */
+static void
+cpu_parse_set(char* list, bool* set) {
+    char* save = NULL;
+    for (char* ptr = strtok_r(list, ",\n", &save); ptr != NULL; ptr = strtok_r(NULL, ",\n", &save)) {
+        int left = atoi(ptr), right = left;
+        char* dash = strchr(ptr, '-');
+        if (dash != NULL)
+            right = atoi(dash + 1);
+        for (int cpu = left; cpu <= right && cpu < MAX_CPU; cpu++)
+            set[cpu] = true;
+    }
+}
+
+/**
+ * Read a CPU list file of sysfs into `set`
+ */
+static int
+cpu_read_set(const char* path, bool* set) {
+    char buff[1024] = {0};
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    if (fgets(buff, sizeof(buff), fp) != NULL)
+        cpu_parse_set(buff, set);
+    fclose(fp);
+    return 0;
+}
+
+/**
+ * The `thread`-th CPU of the physical core `core` among the candidates
+ */
+static int
+cpu_thread_of(const bool* cand, const int* key, int core, int thread) {
+    for (int cpu = core; cpu < MAX_CPU; cpu++) {
+        if (cand[cpu] == true && key[cpu] == core && thread-- == 0)
+            return cpu;
+    }
+    return -1;
+}
+
+int
+cpu_place(int numa_node, int num_worker, bool has_main, struct cpu_slot_t* slots) {
+    bool* cand     = (bool*) calloc(MAX_CPU, sizeof(bool));
+    bool* online   = (bool*) calloc(MAX_CPU, sizeof(bool));
+    bool* reserved = (bool*) calloc(MAX_CPU, sizeof(bool));
+    int*  key      = (int*)  calloc(MAX_CPU, sizeof(int));
+    int*  cores    = (int*)  calloc(MAX_CPU, sizeof(int));
+    int   num_core = 0, num_slot = 0;
+
+    char* cpu_list = NULL;
+    if (nic_getcpus_by_numa(numa_node, &cpu_list) == 0) {
+        cpu_parse_set(cpu_list, cand);
+        free(cpu_list);
+    }
+    // Without the files every CPU counts as online and as a core of its own
+    if (cpu_read_set("/sys/devices/system/cpu/online", online) != 0)
+        memset(online, true, MAX_CPU * sizeof(bool));
+    cpu_read_set("/sys/devices/system/cpu/isolated", reserved);
+    cpu_read_set("/sys/devices/system/cpu/nohz_full", reserved);
+
+    for (int cpu = 0; cpu < MAX_CPU; cpu++) {
+        cand[cpu] = cand[cpu] && online[cpu];
+        if (cand[cpu] == false)
+            continue;
+        bool siblings[MAX_CPU] = {0};
+        char path[96] = {0};
+        sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        key[cpu] = cpu;
+        if (cpu_read_set(path, siblings) == 0) {
+            for (int sib = 0; sib < cpu; sib++) {
+                if (siblings[sib] == true) {
+                    key[cpu] = sib;
+                    break;
+                }
+            }
+        }
+        if (key[cpu] == cpu)
+            cores[num_core++] = cpu;
+    }
+
+    // Order of the physical cores for the workers: isolcpus/nohz_full first,
+    // the core of CPU 0 (timers and most IRQs) last
+    for (int loop = 1; loop < num_core; loop++) {
+        int core = cores[loop], idx = loop;
+        int rank = (reserved[core] ? 0 : 1) + (core == 0);
+        while (idx > 0 && (reserved[cores[idx-1]] ? 0 : 1) + (cores[idx-1] == 0) > rank) {
+            cores[idx] = cores[idx-1];
+            idx--;
+        }
+        cores[idx] = core;
+    }
+
+    // Slot 0 is the main lcore's, it takes the last core in that order if the
+    // workers leave one, otherwise the first CPU left after the workers
+    int main_core = -1;
+    num_slot = has_main ? 1 : 0;
+    if (has_main == true && num_core > num_worker) {
+        main_core = cores[--num_core];
+        slots[0].cpu = main_core;
+    }
+    bool main_pending = (has_main == true && main_core < 0);
+
+    // One CPU of every physical core, then the second SMT thread of each, ...
+    int need = num_worker + num_slot;
+    for (int thread = 0; num_slot < need || main_pending == true; thread++) {
+        bool found = false;
+        for (int loop = 0; loop < num_core && (num_slot < need || main_pending == true); loop++) {
+            int cpu = cpu_thread_of(cand, key, cores[loop], thread);
+            if (cpu < 0)
+                continue;
+            found = true;
+            if (num_slot < need) {
+                slots[num_slot++].cpu = cpu;
+            } else {
+                slots[0].cpu = cpu;
+                main_pending = false;
+            }
+        }
+        if (found == false)
+            break;
+    }
+    // Short of CPUs, slot 0 stays empty and only the workers are annotated
+    int picked = num_slot - (main_pending ? 1 : 0);
+    int first  = main_pending ? 1 : 0;
+    for (int loop = first; loop < num_slot; loop++) {
+        int cpu = slots[loop].cpu;
+        slots[loop].core        = key[cpu];
+        slots[loop].is_reserved = reserved[cpu];
+        slots[loop].is_shared   = false;
+        for (int other = first; other < num_slot; other++) {
+            if (other != loop && key[slots[other].cpu] == key[cpu])
+                slots[loop].is_shared = true;
+        }
+    }
+
+    free(cand);
+    free(online);
+    free(reserved);
+    free(key);
+    free(cores);
+    return picked;
+}
+
 bool 
 has_suffix(char* str, char* suf) {
     int n1 = strlen(str), n2 = strlen(suf);
@@ -358,45 +501,87 @@ time_strto_tv(char* time, struct timeval* tv) {
     return success;
 }
 
+/**
+ * ns = (cycles * cyc2ns_mult) >> CYC2NS_SHIFT, so that converting a sample
+ * costs one multiplication instead of a 64-bit division
+ */
+#define CYC2NS_SHIFT 32
+static uint64_t timer_hz    = 0;
+static uint64_t cyc2ns_mult = 0;
+
+void init_cycles(void) {
+    timer_hz = rte_get_timer_hz();
+    cyc2ns_mult = (uint64_t) ((((unsigned __int128) 1000000000) << CYC2NS_SHIFT) / timer_hz);
+}
+
+static inline uint64_t get_hz(void) {
+    if (unlikely(timer_hz == 0))
+        init_cycles();
+    return timer_hz;
+}
+
+int time_strto_unit(const char* str) {
+    if (strcmp(str, "ns") == 0)
+        return UNIT_NS;
+    else if (strcmp(str, "us") == 0)
+        return UNIT_US;
+    else if (strcmp(str, "ms") == 0)
+        return UNIT_MS;
+    return -1;
+}
+
+const char* time_unit_str(uint8_t unit) {
+    switch (unit) {
+    case UNIT_US:
+        return "us";
+    case UNIT_MS:
+        return "ms";
+    default:
+        return "ns";
+    }
+}
+
 uint64_t time_to_hz_tv(struct timeval t) {
     uint64_t ret = 0;
-    uint64_t hz = rte_get_timer_hz();
+    uint64_t hz = get_hz();
 
     ret = time_double(t) * hz;
     return ret;
 }
 uint64_t time_to_hz_s(uint32_t t) {
     uint64_t ret = 0;
-    uint64_t hz = rte_get_timer_hz();
+    uint64_t hz = get_hz();
 
     ret = t * hz;
     return ret;
 }
 uint64_t time_to_hz_ms(uint32_t t) {
     uint64_t ret = 0;
-    uint64_t hz = rte_get_timer_hz();
+    uint64_t hz = get_hz();
 
     ret = t * hz / 1000;
     return ret;
 }
 uint64_t time_to_hz_us(uint32_t t) {
     uint64_t ret = 0;
-    uint64_t hz = rte_get_timer_hz();
+    uint64_t hz = get_hz();
 
     ret = t * hz / 1000000;
     return ret;
 }
+uint64_t hz_to_ns(uint64_t t) {
+    if (unlikely(cyc2ns_mult == 0))
+        init_cycles();
+    return (uint64_t) (((unsigned __int128) t * cyc2ns_mult) >> CYC2NS_SHIFT);
+}
 uint64_t hz_to_us(uint64_t t) {
-    uint64_t hz = rte_get_timer_hz();
-    return t * 1000000 / hz;
+    return hz_to_ns(t) / 1000;
 }
 uint64_t hz_to_ms(uint64_t t) {
-    uint64_t hz = rte_get_timer_hz();
-    return t * 1000 / hz;
+    return hz_to_ns(t) / 1000000;
 }
 uint64_t hz_to_s(uint64_t t) {
-    uint64_t hz = rte_get_timer_hz();
-    return t / hz;
+    return t / get_hz();
 }
 struct timeval hz_to_tv(uint64_t t) {
     struct timeval ret = {0};
@@ -405,3 +590,23 @@ struct timeval hz_to_tv(uint64_t t) {
     ret.tv_usec= us % 1000000;
     return ret;
 }
+double hz_to_unit(uint64_t t, uint8_t unit) {
+    switch (unit) {
+    case UNIT_US:
+        return hz_to_ns(t) / 1000.0;
+    case UNIT_MS:
+        return hz_to_ns(t) / 1000000.0;
+    default:
+        return (double) hz_to_ns(t);
+    }
+}
+uint64_t hist_percentile(const uint64_t* hist, uint64_t total, double perc) {
+    uint64_t rank = perc * total / 100.0;
+    uint64_t sum = 0;
+    for (uint32_t loop = 0; loop < HIST_SIZE; loop++) {
+        sum += hist[loop];
+        if (sum > rank)
+            return hist_value(loop);
+    }
+    return hist_value(HIST_SIZE - 1);
+}
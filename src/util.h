@@ -1,5 +1,5 @@
 #ifndef _UTIL_H_
-#define _UTIL_H
+#define _UTIL_H_
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -103,7 +103,12 @@ int nic_getbusinfo_by_name(const char* nic_name, char** businfo);
 int nic_getnumanode_by_businfo(const char* businfo);
 
 /**
- * Execute 'lscpu' and return the cpu list for the given numa_node
+ * Max length of a cpu list read from sysfs
+ */
+#define LEN_CPU_LIST 256
+
+/**
+ * Read the cpu list of the given numa_node from sysfs
  * 
  * @para numa_node
  *   Index of numa node 
@@ -162,6 +167,41 @@ struct rte_ether_addr nic_getarp_by_ip(char* ip_addr);
  */
 int cpu_getmask(char* cpu_list, int num_core, char** core_mask);
 
+/**
+ * Max number of CPUs the lcore placement looks at
+ */
+#define MAX_CPU 1024
+
+/**
+ * A CPU picked for an lcore
+ */
+struct cpu_slot_t {
+    int cpu;
+    int core;                   // Lowest CPU of its physical core (thread_siblings_list)
+    bool is_reserved;           // Listed in isolcpus or nohz_full
+    bool is_shared;             // Another picked CPU is its SMT sibling
+};
+
+/**
+ * Pick the CPUs of a NUMA node for the lcores, from the topology in
+ * /sys/devices/system/cpu. Every physical core gives one CPU before any SMT
+ * sibling is taken, workers go to isolcpus/nohz_full cores first and to the
+ * core of CPU 0 last, the main lcore gets a physical core of its own if the
+ * node has one to spare.
+ *
+ * @para numa_node
+ *   Index of numa node
+ * @para num_worker
+ *   Number of worker lcores on the node
+ * @para has_main
+ *   The main lcore is on the node as well
+ * @para slots
+ *   (OUT) The main lcore first if has_main, then the workers
+ * @return
+ *   Number of CPUs picked, less than num_worker + has_main if the node runs out
+ */
+int cpu_place(int numa_node, int num_worker, bool has_main, struct cpu_slot_t* slots);
+
 /**
  * Convert a string to struct timeval tv
  *
@@ -197,14 +237,78 @@ time_double(struct timeval t) {
     return t.tv_sec + t.tv_usec / 1000000.0;
 }
 
+/**
+ * Units used to report latency
+ */
+#define UNIT_NS               0
+#define UNIT_US               1
+#define UNIT_MS               2
+
+/**
+ * Precompute the timer frequency and the fixed-point cycles-to-ns multiplier.
+ * Must be called once after rte_eal_init(); the converters below fall back to
+ * calling it lazily otherwise.
+ */
+void init_cycles(void);
+
+/**
+ * Convert a unit string (ns/us/ms) to UNIT_XX
+ *
+ * @para str
+ *   ns, us or ms
+ * @return
+ *   UNIT_XX, if success
+ *  -1, otherwise
+ */
+int time_strto_unit(const char* str);
+const char* time_unit_str(uint8_t unit);
+
 uint64_t time_to_hz_tv(struct timeval t);
 uint64_t time_to_hz_s(uint32_t t);
 uint64_t time_to_hz_ms(uint32_t t);
 uint64_t time_to_hz_us(uint32_t t);
+uint64_t hz_to_ns(uint64_t t);
 uint64_t hz_to_us(uint64_t t);
 uint64_t hz_to_ms(uint64_t t);
 uint64_t hz_to_s(uint64_t t);
 struct timeval hz_to_tv(uint64_t t);
+double hz_to_unit(uint64_t t, uint8_t unit);
+
+/**
+ * Log-linear histogram: values below 2^(HIST_SUB_BITS+1) have their own bucket,
+ * larger ones fall into 2^HIST_SUB_BITS buckets per power of two (~3% error)
+ */
+#define HIST_SUB_BITS         5
+#define HIST_SIZE             ((65 - HIST_SUB_BITS) << HIST_SUB_BITS)
+
+static inline uint32_t
+hist_index(uint64_t v) {
+    if (v < (2ULL << HIST_SUB_BITS))
+        return v;
+    int e = 63 - __builtin_clzll(v);
+    return ((e - HIST_SUB_BITS) << HIST_SUB_BITS) + (v >> (e - HIST_SUB_BITS));
+}
+
+static inline uint64_t
+hist_value(uint32_t idx) {
+    if (idx < (2U << HIST_SUB_BITS))
+        return idx;
+    return ((uint64_t) ((idx & ((1U << HIST_SUB_BITS) - 1)) | (1U << HIST_SUB_BITS))) << ((idx >> HIST_SUB_BITS) - 1);
+}
+
+/**
+ * Get the value at the given percentile of a histogram
+ *
+ * @para hist
+ *   Histogram of HIST_SIZE buckets
+ * @para total
+ *   Number of samples in the histogram
+ * @para perc
+ *   Percentile, e.g., 99.9
+ * @return
+ *   Lower bound of the bucket the percentile falls into
+ */
+uint64_t hist_percentile(const uint64_t* hist, uint64_t total, double perc);
 
 /**
  * Print raw packet content.